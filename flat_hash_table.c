@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <string.h>
+#include "flat_hash_table.h"
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define FLAT_CTRL_EMPTY     ((signed char) -128)
+#define FLAT_CTRL_DELETED   ((signed char) -2)
+
+#define FLAT_CACHE_LINE     64U
+#define FLAT_POS_NONE       (~0U)
+
+#define flat_h1(hash)       ((hash) >> 7)
+#define flat_h2(hash)       ((signed char) ((hash) & 0x7F))
+
+#if defined (__SSE2__)
+/* 返回组内控制字节等于c的槽位掩码 */
+static inline unsigned int flat_group_match(const signed char *__restrict ctrl, const signed char c)
+{
+    __m128i g = _mm_load_si128((const __m128i *) ctrl);
+
+    return (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(c)));
+}
+
+/* 空和删除的控制字节最高位都为1 */
+static inline unsigned int flat_group_match_free(const signed char *__restrict ctrl)
+{
+    return (unsigned int) _mm_movemask_epi8(_mm_load_si128((const __m128i *) ctrl));
+}
+#else
+static inline unsigned int flat_group_match(const signed char *__restrict ctrl, const signed char c)
+{
+    unsigned int i;
+    unsigned int mask;
+
+    for (mask = 0, i = 0; i < FLAT_HASH_TABLE_GROUP_SIZE; i++) {
+        if (ctrl[i] == c)
+            mask |= 1U << i;
+    }
+
+    return mask;
+}
+
+static inline unsigned int flat_group_match_free(const signed char *__restrict ctrl)
+{
+    unsigned int i;
+    unsigned int mask;
+
+    for (mask = 0, i = 0; i < FLAT_HASH_TABLE_GROUP_SIZE; i++) {
+        if (ctrl[i] < 0)
+            mask |= 1U << i;
+    }
+
+    return mask;
+}
+#endif
+
+static inline unsigned int flat_group_match_empty(const signed char *__restrict ctrl)
+{
+    return flat_group_match(ctrl, FLAT_CTRL_EMPTY);
+}
+
+/* 最大负载因子7/8 */
+static inline unsigned int flat_capacity_to_growth(const unsigned int groups)
+{
+    return groups * FLAT_HASH_TABLE_GROUP_SIZE - groups * FLAT_HASH_TABLE_GROUP_SIZE / 8;
+}
+
+/* 控制字节的大小向上对齐到cache line, 使槽位数组也从cache line开始 */
+static inline size_t flat_ctrl_size(const unsigned int groups)
+{
+    return ((size_t) groups * FLAT_HASH_TABLE_GROUP_SIZE + FLAT_CACHE_LINE - 1) & ~((size_t) FLAT_CACHE_LINE - 1);
+}
+
+/* 控制字节和槽位放在同一块内存中, 释放时只需free(ctrl) */
+static bool flat_alloc_groups(const unsigned int groups, signed char **ctrl,
+                struct flat_hash_table_slot **slots)
+{
+    void *mem;
+
+    if (posix_memalign(&mem, FLAT_CACHE_LINE, flat_ctrl_size(groups)
+            + (size_t) groups * FLAT_HASH_TABLE_GROUP_SIZE * sizeof(struct flat_hash_table_slot)) != 0)
+        return false;
+
+    *ctrl = (signed char *) mem;
+    *slots = (struct flat_hash_table_slot *) ((char *) mem + flat_ctrl_size(groups));
+    memset(*ctrl, FLAT_CTRL_EMPTY, (size_t) groups * FLAT_HASH_TABLE_GROUP_SIZE);
+
+    return true;
+}
+
+/* 在探测序列上找到第一个空闲槽位, 组数是2的幂, 三角数探测可以遍历所有组 */
+static void flat_hash_table_place(signed char *__restrict ctrl, struct flat_hash_table_slot *__restrict slots,
+                const unsigned int group_mask, const unsigned int hash,
+                struct hlist_node *__restrict node, signed char *old_ctrl)
+{
+    unsigned int i;
+    unsigned int gi;
+    unsigned int pos;
+    unsigned int mask;
+
+    for (gi = flat_h1(hash) & group_mask, i = 1; ; gi = (gi + i++) & group_mask) {
+        mask = flat_group_match_free(ctrl + gi * FLAT_HASH_TABLE_GROUP_SIZE);
+        if (mask) {
+            pos = gi * FLAT_HASH_TABLE_GROUP_SIZE + __builtin_ctz(mask);
+            if (old_ctrl)
+                *old_ctrl = ctrl[pos];
+            ctrl[pos] = flat_h2(hash);
+            slots[pos].hash = hash;
+            slots[pos].node = node;
+            return;
+        }
+    }
+}
+
+static bool flat_hash_table_resize(flat_hash_table_t *__restrict t, const unsigned int groups)
+{
+    unsigned int i;
+    signed char *ctrl;
+    struct flat_hash_table_slot *slots;
+
+    if (!flat_alloc_groups(groups, &ctrl, &slots))
+        return false;
+
+    /* 槽位中保存了完整hash, 迁移时不需要调用hash回调 */
+    for (i = 0; i < (t->group_mask + 1) * FLAT_HASH_TABLE_GROUP_SIZE; i++) {
+        if (t->ctrl[i] >= 0)
+            flat_hash_table_place(ctrl, slots, groups - 1, t->slots[i].hash, t->slots[i].node, NULL);
+    }
+
+    free(t->ctrl);
+    t->ctrl = ctrl;
+    t->slots = slots;
+    t->group_mask = groups - 1;
+    t->deleted = 0;
+    t->growth_left = flat_capacity_to_growth(groups) - t->count;
+
+    return true;
+}
+
+flat_hash_table_t *flat_hash_table_create(const unsigned int size,
+                            const hash_table_index_func_t hash,
+                            const hash_table_release_func_t release)
+{
+    unsigned int groups;
+    flat_hash_table_t *t;
+
+    if (!size || !hash || !release)
+        return NULL;
+
+    for (groups = 1; flat_capacity_to_growth(groups) < size; groups <<= 1) {
+        if (groups >= 0x08000000U)
+            return NULL;
+    }
+
+    t = (flat_hash_table_t *) malloc(sizeof(*t));
+    if (!t)
+        return NULL;
+
+    if (!flat_alloc_groups(groups, &t->ctrl, &t->slots)) {
+        free(t);
+        return NULL;
+    }
+
+    t->group_mask = groups - 1;
+    t->count = 0;
+    t->deleted = 0;
+    t->growth_left = flat_capacity_to_growth(groups);
+    t->hash = hash;
+    t->release = release;
+
+    return t;
+}
+
+bool flat_hash_table_add(flat_hash_table_t *__restrict t, struct hlist_node *__restrict node)
+{
+    unsigned int groups;
+    signed char old_ctrl;
+
+    if (!t || !node)
+        return false;
+
+    if (!t->growth_left) {
+        /* 删除标记过多时原地整理, 否则扩容一倍 */
+        groups = t->group_mask + 1;
+        if (t->deleted < t->count / 2) {
+            if (groups >= 0x08000000U)
+                return false;
+            groups <<= 1;
+        }
+
+        if (!flat_hash_table_resize(t, groups))
+            return false;
+    }
+
+    flat_hash_table_place(t->ctrl, t->slots, t->group_mask, t->hash(node), node, &old_ctrl);
+    if (old_ctrl == FLAT_CTRL_DELETED)
+        t->deleted--;
+    else
+        t->growth_left--;
+    t->count++;
+
+    return true;
+}
+
+/*
+ * 沿探测序列查找, 返回槽位下标, 没找到返回FLAT_POS_NONE.
+ * node不为NULL时按节点地址匹配, 否则比较完整hash, equal不为NULL时再比较键
+ */
+static unsigned int flat_hash_table_probe(const flat_hash_table_t *__restrict t,
+                const unsigned int hash, const struct hlist_node *__restrict node,
+                const void *__restrict key, const hash_table_equal_func_t equal)
+{
+    unsigned int i;
+    unsigned int gi;
+    unsigned int pos;
+    unsigned int mask;
+    const signed char *ctrl;
+    const struct flat_hash_table_slot *slot;
+
+    for (gi = flat_h1(hash) & t->group_mask, i = 1; i <= t->group_mask + 1;
+            gi = (gi + i++) & t->group_mask) {
+        ctrl = t->ctrl + gi * FLAT_HASH_TABLE_GROUP_SIZE;
+        for (mask = flat_group_match(ctrl, flat_h2(hash)); mask; mask &= mask - 1) {
+            pos = gi * FLAT_HASH_TABLE_GROUP_SIZE + __builtin_ctz(mask);
+            slot = t->slots + pos;
+            if (node ? slot->node == node
+                    : slot->hash == hash && (!equal || equal(slot->node, key)))
+                return pos;
+        }
+
+        if (flat_group_match_empty(ctrl))
+            break;
+    }
+
+    return FLAT_POS_NONE;
+}
+
+/* 组内还有空槽说明探测不会越过这一组, 可以直接置空, 否则只能标记为删除 */
+static void flat_hash_table_erase(flat_hash_table_t *__restrict t, const unsigned int pos)
+{
+    if (flat_group_match_empty(t->ctrl + (pos & ~(FLAT_HASH_TABLE_GROUP_SIZE - 1)))) {
+        t->ctrl[pos] = FLAT_CTRL_EMPTY;
+        t->growth_left++;
+    } else {
+        t->ctrl[pos] = FLAT_CTRL_DELETED;
+        t->deleted++;
+    }
+    t->count--;
+}
+
+struct hlist_node *flat_hash_table_find(const flat_hash_table_t *__restrict t,
+                            const unsigned int hash)
+{
+    return flat_hash_table_find_key(t, hash, NULL, NULL);
+}
+
+struct hlist_node *flat_hash_table_find_key(const flat_hash_table_t *__restrict t,
+                            const unsigned int hash, const void *__restrict key,
+                            const hash_table_equal_func_t equal)
+{
+    unsigned int pos;
+
+    if (!t)
+        return NULL;
+
+    pos = flat_hash_table_probe(t, hash, NULL, key, equal);
+
+    return pos == FLAT_POS_NONE ? NULL : t->slots[pos].node;
+}
+
+bool flat_hash_table_del(flat_hash_table_t *__restrict t, const struct hlist_node *__restrict node)
+{
+    unsigned int pos;
+
+    if (!t || !node)
+        return false;
+
+    pos = flat_hash_table_probe(t, t->hash(node), node, NULL, NULL);
+    if (pos == FLAT_POS_NONE)
+        return false;
+
+    flat_hash_table_erase(t, pos);
+
+    return true;
+}
+
+struct hlist_node *flat_hash_table_del_key(flat_hash_table_t *__restrict t,
+                            const unsigned int hash, const void *__restrict key,
+                            const hash_table_equal_func_t equal)
+{
+    unsigned int pos;
+    struct hlist_node *node;
+
+    if (!t)
+        return NULL;
+
+    pos = flat_hash_table_probe(t, hash, NULL, key, equal);
+    if (pos == FLAT_POS_NONE)
+        return NULL;
+
+    node = t->slots[pos].node;
+    flat_hash_table_erase(t, pos);
+
+    return node;
+}
+
+void flat_hash_table_destory(flat_hash_table_t *__restrict t)
+{
+    unsigned int i;
+
+    if (t) {
+        for (i = 0; i < (t->group_mask + 1) * FLAT_HASH_TABLE_GROUP_SIZE; i++) {
+            if (t->ctrl[i] >= 0)
+                t->release(t->slots[i].node);
+        }
+        free(t->ctrl);
+        free(t);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef _BASIC_LIB_FLAT_HASH_TABLE_H_
+#define _BASIC_LIB_FLAT_HASH_TABLE_H_
+
+#include <stdbool.h>
+#include "hash_table.h"
+
+/*
+ * 开放寻址的哈希表(swiss table), 与dual_hash_table_t使用相同的hash/release回调.
+ * 每16个槽位组成一组, 控制字节(空/删除/hash的低7位)单独连续存放, 一条cache line放4组,
+ * 完整的32位hash和节点指针放在同一个槽位里, 一条cache line放4个槽位.
+ * 查找时用SIMD一次比较一组控制字节, 命中后再比较槽位中的完整hash, 不再调用hash回调,
+ * 所以一次命中通常访问2条cache line(控制字节和槽位), 需要比较键时再加上节点本身
+ */
+#define FLAT_HASH_TABLE_GROUP_SIZE  16
+
+struct flat_hash_table_slot {
+    unsigned int hash;
+    struct hlist_node *node;
+};
+
+typedef struct {
+    unsigned int group_mask;        /* 组数 - 1 */
+    unsigned int count;             /* 元素个数 */
+    unsigned int deleted;           /* 被标记为删除的槽位数 */
+    unsigned int growth_left;       /* 不扩容还能插入的元素个数 */
+    hash_table_index_func_t hash;
+    hash_table_release_func_t release;
+    signed char *ctrl;              /* 组数 * 16个控制字节, 与slots在同一块内存中 */
+    struct flat_hash_table_slot *slots;
+} flat_hash_table_t;
+
+extern flat_hash_table_t *flat_hash_table_create(const unsigned int size,
+                            const hash_table_index_func_t hash,
+                            const hash_table_release_func_t release);
+
+/* 直接插入, 不检查是否存在相同的键 */
+extern bool flat_hash_table_add(flat_hash_table_t *__restrict t,
+                struct hlist_node *__restrict node);
+
+/* 返回第一个完整hash等于hash的节点, 不同的键hash相同时可能返回别的节点, 需要区分时用flat_hash_table_find_key */
+extern struct hlist_node *flat_hash_table_find(const flat_hash_table_t *__restrict t,
+                            const unsigned int hash);
+
+/* 按hash和键查找, equal为NULL时只比较hash, 与dual_hash_table_find_key相同 */
+extern struct hlist_node *flat_hash_table_find_key(const flat_hash_table_t *__restrict t,
+                            const unsigned int hash, const void *__restrict key,
+                            const hash_table_equal_func_t equal);
+
+/* 从表中摘除节点, 不调用release */
+extern bool flat_hash_table_del(flat_hash_table_t *__restrict t,
+                const struct hlist_node *__restrict node);
+
+/* 按hash和键摘除节点, 不调用release, 返回被摘除的节点, 没找到返回NULL */
+extern struct hlist_node *flat_hash_table_del_key(flat_hash_table_t *__restrict t,
+                            const unsigned int hash, const void *__restrict key,
+                            const hash_table_equal_func_t equal);
+
+static inline unsigned int flat_hash_table_count(const flat_hash_table_t *__restrict t)
+{
+    return t->count;
+}
+
+extern void flat_hash_table_destory(flat_hash_table_t *__restrict t);
+
+#endif /* _BASIC_LIB_FLAT_HASH_TABLE_H_ */
@@ -25,7 +25,17 @@ static inline unsigned int hash_table_hash2index(const unsigned int size, const
     return hash & size;
 }
 
-#define hash_oob(size, hash)    ((size) > (hash))
+static inline unsigned int hash_table_bucket_count(const unsigned int size)
+{
+    return size + 1;
+}
+
+static inline unsigned int hash_table_grow_size(const unsigned int size)
+{
+    return (size << 1) | 1;
+}
+
+#define hash_oob(size, hash)    ((hash) > (size))
 #else
 static inline unsigned int hash_table_round_size(const unsigned int size)
 {
@@ -37,12 +47,102 @@ static inline unsigned int hash_table_hash2index(const unsigned int size, const
     return hash % size;
 }
 
-#define hash_oob(size, hash)    ((size) >= (hash))
+static inline unsigned int hash_table_bucket_count(const unsigned int size)
+{
+    return size;
+}
+
+static inline unsigned int hash_table_grow_size(const unsigned int size)
+{
+    return size << 1;
+}
+
+#define hash_oob(size, hash)    ((hash) >= (size))
 #endif
 
-dual_hash_table_t *dual_hash_table_create(const unsigned int size,
+/* 桶数超过该值后不再扩容 */
+#define HASH_TABLE_MAX_BUCKETS  0x40000000U
+
+static inline unsigned int dual_hash_table_mask(const dual_hash_table_t *__restrict t,
+                const unsigned int i)
+{
+    return i == t->using_index ? t->index_mask : t->last_mask;
+}
+
+static inline unsigned int dual_hash_table_node_hash(const dual_hash_table_t *__restrict t,
+                const struct hlist_node *__restrict node)
+{
+    if (t->flags & DUAL_HASH_TABLE_F_CACHED_HASH)
+        return hash_table_node_entry(node)->hash;
+
+    return t->hash(node);
+}
+
+static struct hlist_head *hash_table_alloc_heads(const unsigned int mask)
+{
+    unsigned int i;
+    struct hlist_head *heads;
+
+    heads = (struct hlist_head *) malloc(hash_table_bucket_count(mask) * sizeof(struct hlist_head));
+    if (heads) {
+        for (i = 0; !hash_oob(mask, i); i++)
+            INIT_HLIST_HEAD(heads + i);
+    }
+
+    return heads;
+}
+
+static inline unsigned int hash_table_histogram_bin(const unsigned int len)
+{
+    return len < DUAL_HASH_TABLE_HISTOGRAM_SIZE - 1 ? len : DUAL_HASH_TABLE_HISTOGRAM_SIZE - 1;
+}
+
+/* 为表i分配链长数组, 所有桶都计入长度为0的直方图项 */
+static bool dual_hash_table_stats_init(dual_hash_table_t *__restrict t, const unsigned int i,
+                const unsigned int mask)
+{
+    memset(t->histogram[i], 0, sizeof(t->histogram[i]));
+    t->chain_len[i] = NULL;
+    if (!(t->flags & DUAL_HASH_TABLE_F_STATS))
+        return true;
+
+    t->chain_len[i] = (unsigned int *) calloc(hash_table_bucket_count(mask), sizeof(unsigned int));
+    if (!t->chain_len[i])
+        return false;
+
+    t->histogram[i][0] = hash_table_bucket_count(mask);
+
+    return true;
+}
+
+static inline void dual_hash_table_chain_inc(dual_hash_table_t *__restrict t,
+                const unsigned int i, const unsigned int index)
+{
+    unsigned int len;
+
+    if (t->flags & DUAL_HASH_TABLE_F_STATS) {
+        len = t->chain_len[i][index]++;
+        t->histogram[i][hash_table_histogram_bin(len)]--;
+        t->histogram[i][hash_table_histogram_bin(len + 1)]++;
+    }
+}
+
+static inline void dual_hash_table_chain_dec(dual_hash_table_t *__restrict t,
+                const unsigned int i, const unsigned int index)
+{
+    unsigned int len;
+
+    if (t->flags & DUAL_HASH_TABLE_F_STATS) {
+        len = t->chain_len[i][index]--;
+        t->histogram[i][hash_table_histogram_bin(len)]--;
+        t->histogram[i][hash_table_histogram_bin(len - 1)]++;
+    }
+}
+
+dual_hash_table_t *dual_hash_table_create_ex(const unsigned int size,
                             const hash_table_index_func_t hash,
-                            const hash_table_release_func_t release)
+                            const hash_table_release_func_t release,
+                            const unsigned int flags)
 {
     unsigned int i;
     unsigned int mask;
@@ -53,27 +153,131 @@ dual_hash_table_t *dual_hash_table_create(const unsigned int size,
         return NULL;
 
     mask = hash_table_round_size(size);
-    table = (dual_hash_table_t *) malloc((mask + 1) * sizeof(struct hlist_head) * 2
-        + sizeof(*table));
-    if (table) {
-        table->using_index = 0;
-        table->index_mask = mask;
-        table->hash = hash;
-        table->release = release;
+    if (flags & DUAL_HASH_TABLE_F_GROWABLE) {
+        table = (dual_hash_table_t *) malloc(sizeof(*table));
+        if (!table)
+            return NULL;
+
+        head1 = hash_table_alloc_heads(mask);
+        if (!head1) {
+            free(table);
+            return NULL;
+        }
+
+        head2 = NULL;
+    } else {
+        table = (dual_hash_table_t *) malloc(hash_table_bucket_count(mask) * sizeof(struct hlist_head) * 2
+            + sizeof(*table));
+        if (!table)
+            return NULL;
+
         head1 = (void *) table + sizeof(*table);
-        head2 = head1 + size;
-        table->table[0] = head1;
-        table->table[1] = head2;
+        head2 = head1 + hash_table_bucket_count(mask);
         for (i = 0; !hash_oob(mask, i); i++) {
             INIT_HLIST_HEAD(head1 + i);
             INIT_HLIST_HEAD(head2 + i);
         }
     }
 
+    table->using_index = 0;
+    table->flags = flags;
+    table->index_mask = mask;
+    table->last_mask = head2 ? mask : 0;
+    table->rehash_index = 0;
+    table->count[0] = 0;
+    table->count[1] = 0;
+    table->hash = hash;
+    table->release = release;
+    table->table[0] = head1;
+    table->table[1] = head2;
+    memset(table->histogram, 0, sizeof(table->histogram));
+    table->chain_len[1] = NULL;
+    if (!dual_hash_table_stats_init(table, 0, mask)
+            || (head2 && !dual_hash_table_stats_init(table, 1, mask))) {
+        free(table->chain_len[0]);
+        if (flags & DUAL_HASH_TABLE_F_GROWABLE)
+            free(head1);
+        free(table);
+        return NULL;
+    }
+
     return table;
 }
 
-bool dual_hash_table_add_using(dual_hash_table_t *__restrict t, struct hlist_node *__restrict node)
+dual_hash_table_t *dual_hash_table_create(const unsigned int size,
+                            const hash_table_index_func_t hash,
+                            const hash_table_release_func_t release)
+{
+    return dual_hash_table_create_ex(size, hash, release, 0);
+}
+
+/* 把旧表中最多step个桶迁移到新表, 迁移完成后释放旧表 */
+static void dual_hash_table_rehash(dual_hash_table_t *__restrict t, unsigned int step)
+{
+    unsigned int last;
+    unsigned int index;
+    struct hlist_node *node;
+    struct hlist_head *head;
+
+    if (!dual_hash_table_rehashing(t))
+        return;
+
+    last = t->using_index ^ 1;
+    for (; step && !hash_oob(t->last_mask, t->rehash_index); step--) {
+        head = t->table[last] + t->rehash_index;
+        while ((node = head->first) != NULL) {
+            __hlist_del(node);
+            index = hash_table_hash2index(t->index_mask, dual_hash_table_node_hash(t, node));
+            hlist_add_head(node, t->table[t->using_index] + index);
+            t->count[last]--;
+            t->count[t->using_index]++;
+            dual_hash_table_chain_dec(t, last, t->rehash_index);
+            dual_hash_table_chain_inc(t, t->using_index, index);
+        }
+        t->rehash_index++;
+    }
+
+    if (hash_oob(t->last_mask, t->rehash_index)) {
+        free(t->table[last]);
+        free(t->chain_len[last]);
+        t->table[last] = NULL;
+        t->chain_len[last] = NULL;
+        memset(t->histogram[last], 0, sizeof(t->histogram[last]));
+        t->last_mask = 0;
+        t->rehash_index = 0;
+    }
+}
+
+/* 负载因子超过1时开始扩容, 新表成为using表, 旧表在后续的add/find中逐步迁移 */
+static void dual_hash_table_try_grow(dual_hash_table_t *__restrict t)
+{
+    unsigned int mask;
+    struct hlist_head *heads;
+
+    if (dual_hash_table_rehashing(t)
+            || t->count[t->using_index] <= hash_table_bucket_count(t->index_mask)
+            || hash_table_bucket_count(t->index_mask) >= HASH_TABLE_MAX_BUCKETS)
+        return;
+
+    mask = hash_table_grow_size(t->index_mask);
+    heads = hash_table_alloc_heads(mask);
+    if (!heads)
+        return;
+
+    if (!dual_hash_table_stats_init(t, t->using_index ^ 1, mask)) {
+        free(heads);
+        return;
+    }
+
+    t->using_index ^= 1;
+    t->table[t->using_index] = heads;
+    t->last_mask = t->index_mask;
+    t->index_mask = mask;
+    t->rehash_index = 0;
+}
+
+bool dual_hash_table_add_using_hash(dual_hash_table_t *__restrict t,
+                struct hlist_node *__restrict node, const unsigned int hash)
 {
     unsigned int index;
     struct hlist_head *head;
@@ -81,61 +285,251 @@ bool dual_hash_table_add_using(dual_hash_table_t *__restrict t, struct hlist_nod
     if (!t || !node)
         return false;
 
+    if (t->flags & DUAL_HASH_TABLE_F_GROWABLE)
+        dual_hash_table_rehash(t, DUAL_HASH_TABLE_REHASH_STEP);
+
     /* insert directly, no checking if has the same key */
-    index = hash_table_hash2index(t->index_mask, t->hash(node));
+    if (t->flags & DUAL_HASH_TABLE_F_CACHED_HASH)
+        hash_table_node_entry(node)->hash = hash;
+    index = hash_table_hash2index(t->index_mask, hash);
     head = t->table[t->using_index] + index;
     hlist_add_head(node, head);
+    t->count[t->using_index]++;
+    dual_hash_table_chain_inc(t, t->using_index, index);
+
+    if (t->flags & DUAL_HASH_TABLE_F_GROWABLE)
+        dual_hash_table_try_grow(t);
+
+    return true;
+}
+
+bool dual_hash_table_add_using(dual_hash_table_t *__restrict t, struct hlist_node *__restrict node)
+{
+    if (!t || !node)
+        return false;
+
+    return dual_hash_table_add_using_hash(t, node, t->hash(node));
+}
+
+/* 在节点所属的桶里确认节点确实在链上, 返回true并给出表和下标 */
+static bool dual_hash_table_bucket_has(const dual_hash_table_t *__restrict t, const unsigned int i,
+                    const unsigned int hash, const struct hlist_node *__restrict node,
+                    unsigned int *__restrict index)
+{
+    struct hlist_node *pos;
+
+    if (!t->table[i])
+        return false;
+
+    *index = hash_table_hash2index(dual_hash_table_mask(t, i), hash);
+    for (pos = t->table[i][*index].first; pos; pos = pos->next) {
+        if (pos == node)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * 由节点的hash算出它可能所在的桶(using表, 以及旧表中尚未迁移的桶), 只遍历这两条链,
+ * 不在表中的节点(包括已经删除的)找不到, 返回-1
+ */
+static int dual_hash_table_node_table(const dual_hash_table_t *__restrict t,
+                    const struct hlist_node *__restrict node, unsigned int *__restrict index)
+{
+    unsigned int i;
+    unsigned int hash;
+
+    if (!node->pprev || node->pprev == LIST_POISON2)
+        return -1;
+
+    hash = dual_hash_table_node_hash(t, node);
+    i = t->using_index;
+    if (dual_hash_table_bucket_has(t, i, hash, node, index))
+        return i;
+
+    i ^= 1;
+    if (dual_hash_table_bucket_has(t, i, hash, node, index))
+        return i;
+
+    return -1;
+}
+
+bool dual_hash_table_del(dual_hash_table_t *__restrict t, struct hlist_node *__restrict node)
+{
+    int i;
+    unsigned int index;
+
+    if (!t || !node)
+        return false;
+
+    i = dual_hash_table_node_table(t, node, &index);
+    if (i < 0)
+        return false;
+
+    t->count[i]--;
+    dual_hash_table_chain_dec(t, i, index);
+    hlist_del(node);
 
     return true;
 }
 
+/* 从node开始沿链查找 */
+static inline struct hlist_node *dual_hash_table_chain_find(const dual_hash_table_t *__restrict t,
+                    struct hlist_node *node, const unsigned int hash,
+                    const void *__restrict key, const hash_table_equal_func_t equal)
+{
+    for (; node; node = node->next) {
+        if (dual_hash_table_node_hash(t, node) == hash
+                && (!equal || equal(node, key)))
+            break;
+    }
+
+    return node;
+}
+
 static struct hlist_node *dual_hash_table_find(dual_hash_table_t *__restrict t,
-                    const unsigned int hash, const unsigned int i)
+                    const unsigned int hash, const void *__restrict key,
+                    const hash_table_equal_func_t equal, const unsigned int i)
 {
     unsigned int index;
-    struct hlist_node *ret;
-    struct hlist_node *node;
     struct hlist_head *head;
 
-    ret = NULL;
-    index = hash_table_hash2index(t->index_mask, hash);
+    if (!t->table[i])
+        return NULL;
+
+    index = hash_table_hash2index(dual_hash_table_mask(t, i), hash);
     head = t->table[i] + index;
-    for (node = head->first; node; node = node->next) {
-        if (t->hash(node) == index) {
-            ret = node;
-            break;
-        }
-    }
 
-    return ret;
+    return dual_hash_table_chain_find(t, head->first, hash, key, equal);
+}
+
+/* 查找using表, 自动扩容模式下旧表中还没迁移的桶也要查 */
+static struct hlist_node *dual_hash_table_lookup(dual_hash_table_t *__restrict t,
+                    const unsigned int hash, const void *__restrict key,
+                    const hash_table_equal_func_t equal)
+{
+    struct hlist_node *node;
+
+    if (!(t->flags & DUAL_HASH_TABLE_F_GROWABLE))
+        return dual_hash_table_find(t, hash, key, equal, t->using_index);
+
+    dual_hash_table_rehash(t, DUAL_HASH_TABLE_REHASH_STEP);
+    node = dual_hash_table_find(t, hash, key, equal, t->using_index);
+    if (!node && dual_hash_table_rehashing(t)
+            && hash_table_hash2index(t->last_mask, hash) >= t->rehash_index)
+        node = dual_hash_table_find(t, hash, key, equal, t->using_index ^ 1);
+
+    return node;
 }
 
 struct hlist_node *dual_hash_table_find_using(dual_hash_table_t *__restrict t,
                     const unsigned int hash)
 {
     if (t)
-        return dual_hash_table_find(t, hash, t->using_index);
+        return dual_hash_table_lookup(t, hash, NULL, NULL);
 
     return NULL;
 }
 
+struct hlist_node *dual_hash_table_find_key(dual_hash_table_t *__restrict t,
+                    const unsigned int hash, const void *__restrict key,
+                    const hash_table_equal_func_t equal)
+{
+    if (t)
+        return dual_hash_table_lookup(t, hash, key, equal);
+
+    return NULL;
+}
+
+/*
+ * 分三轮处理一批查找: 先预取所有桶头, 再预取所有链上的第一个节点, 最后逐个比较,
+ * 让一批查找的访存延迟互相重叠
+ */
+static unsigned int dual_hash_table_find_batch(dual_hash_table_t *__restrict t,
+                    const unsigned int *__restrict hashes, const void *const *__restrict keys,
+                    const hash_table_equal_func_t equal, const unsigned int n,
+                    struct hlist_node **__restrict nodes)
+{
+    unsigned int i;
+    unsigned int found;
+    struct hlist_node *node;
+    struct hlist_head *heads[DUAL_HASH_TABLE_BULK_MAX];
+
+    for (i = 0; i < n; i++) {
+        heads[i] = t->table[t->using_index] + hash_table_hash2index(t->index_mask, hashes[i]);
+        prefetch(heads[i]);
+    }
+
+    for (i = 0; i < n; i++) {
+        nodes[i] = heads[i]->first;
+        if (nodes[i]) {
+            prefetch(nodes[i]);
+            if (t->flags & DUAL_HASH_TABLE_F_CACHED_HASH)
+                prefetch(&hash_table_node_entry(nodes[i])->hash);
+        }
+    }
+
+    for (found = 0, i = 0; i < n; i++) {
+        node = dual_hash_table_chain_find(t, nodes[i], hashes[i], keys ? keys[i] : NULL, equal);
+        if (!node && dual_hash_table_rehashing(t)
+                && hash_table_hash2index(t->last_mask, hashes[i]) >= t->rehash_index)
+            node = dual_hash_table_find(t, hashes[i], keys ? keys[i] : NULL, equal, t->using_index ^ 1);
+
+        nodes[i] = node;
+        if (node)
+            found++;
+    }
+
+    return found;
+}
+
+unsigned int dual_hash_table_find_bulk(dual_hash_table_t *__restrict t,
+                    const unsigned int *__restrict hashes, const void *const *__restrict keys,
+                    const hash_table_equal_func_t equal, const unsigned int n,
+                    struct hlist_node **__restrict nodes)
+{
+    unsigned int i;
+    unsigned int batch;
+    unsigned int found;
+
+    if (!t || !hashes || !nodes)
+        return 0;
+
+    if (t->flags & DUAL_HASH_TABLE_F_GROWABLE)
+        dual_hash_table_rehash(t, DUAL_HASH_TABLE_REHASH_STEP);
+
+    for (found = 0, i = 0; i < n; i += batch) {
+        batch = n - i < DUAL_HASH_TABLE_BULK_MAX ? n - i : DUAL_HASH_TABLE_BULK_MAX;
+        found += dual_hash_table_find_batch(t, hashes + i, keys ? keys + i : NULL,
+                    equal, batch, nodes + i);
+    }
+
+    return found;
+}
+
 struct hlist_node *dual_hash_table_find_last(dual_hash_table_t *__restrict t,
                     const unsigned int hash)
 {
     if (t)
-        return dual_hash_table_find(t, hash, t->using_index ^ 1);
+        return dual_hash_table_find(t, hash, NULL, NULL, t->using_index ^ 1);
 
     return NULL;
 }
 
 static void dual_hash_table_clean(dual_hash_table_t *__restrict t, const unsigned int i)
 {
+    unsigned int mask;
     unsigned int index;
     struct hlist_node *tmp;
     struct hlist_node *node;
     struct hlist_head *head;
 
-    for (index = 0; !hash_oob(t->index_mask, index); index++) {
+    if (!t->table[i])
+        return;
+
+    mask = dual_hash_table_mask(t, i);
+    for (index = 0; !hash_oob(mask, index); index++) {
         head = t->table[i] + index;
         for (node = head->first; node; node = tmp) {
             tmp = node->next;
@@ -143,6 +537,50 @@ static void dual_hash_table_clean(dual_hash_table_t *__restrict t, const unsigne
             t->release(node);
         }
     }
+    t->count[i] = 0;
+
+    if (t->flags & DUAL_HASH_TABLE_F_STATS) {
+        memset(t->chain_len[i], 0, hash_table_bucket_count(mask) * sizeof(unsigned int));
+        memset(t->histogram[i], 0, sizeof(t->histogram[i]));
+        t->histogram[i][0] = hash_table_bucket_count(mask);
+    }
+}
+
+bool dual_hash_table_stats(const dual_hash_table_t *__restrict t,
+                dual_hash_table_stats_t *__restrict stats)
+{
+    unsigned int i;
+    unsigned int j;
+    unsigned int used;
+    unsigned int count;
+
+    if (!t || !stats)
+        return false;
+
+    memset(stats, 0, sizeof(*stats));
+    for (used = 0, count = 0, i = 0; i < 2; i++) {
+        if (!t->table[i])
+            continue;
+
+        stats->buckets[i] = hash_table_bucket_count(dual_hash_table_mask(t, i));
+        stats->count[i] = t->count[i];
+        count += t->count[i];
+        if (!(t->flags & DUAL_HASH_TABLE_F_STATS))
+            continue;
+
+        for (j = 0; j < DUAL_HASH_TABLE_HISTOGRAM_SIZE; j++) {
+            stats->histogram[i][j] = t->histogram[i][j];
+            if (j && t->histogram[i][j] && j > stats->max_chain)
+                stats->max_chain = j;
+        }
+        used += stats->buckets[i] - t->histogram[i][0];
+    }
+
+    stats->load_factor = (double) t->count[t->using_index] / stats->buckets[t->using_index];
+    if (used)
+        stats->mean_chain = (double) count / used;
+
+    return true;
 }
 
 void dual_hash_table_clean_using(dual_hash_table_t *__restrict t, const unsigned int i)
@@ -162,6 +600,12 @@ void dual_hash_table_destory(dual_hash_table_t *__restrict t)
     if (t) {
         dual_hash_table_clean(t, t->using_index);
         dual_hash_table_clean(t, t->using_index ^ 1);
+        if (t->flags & DUAL_HASH_TABLE_F_GROWABLE) {
+            free(t->table[0]);
+            free(t->table[1]);
+        }
+        free(t->chain_len[0]);
+        free(t->chain_len[1]);
         free(t);
     }
 }
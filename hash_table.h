@@ -7,40 +7,135 @@
 /* hash函数直接计算出下标 */
 typedef unsigned int (*hash_table_index_func_t)(const struct hlist_node *__restrict element);
 typedef void (*hash_table_release_func_t)(const struct hlist_node *__restrict node);
+/* 比较节点的键与key是否相同 */
+typedef bool (*hash_table_equal_func_t)(const struct hlist_node *__restrict node,
+                const void *__restrict key);
+
+/* 带hash缓存的节点, 查找时先比较hash, 相同再调用equal比较键 */
+struct hash_table_node {
+    struct hlist_node node;
+    unsigned int hash;
+};
+
+#define hash_table_node_entry(ptr)  container_of(ptr, struct hash_table_node, node)
+
+/*
+ * 自动扩容模式: table[using_index]为新表, table[using_index ^ 1]为正在迁移的旧表,
+ * 每次add/find最多迁移DUAL_HASH_TABLE_REHASH_STEP个旧桶, 不会因为扩容卡住调用者
+ */
+#define DUAL_HASH_TABLE_F_GROWABLE      0x01U
+/* 表中的节点都是struct hash_table_node, 插入时缓存完整hash, 查找和迁移不再调用hash回调 */
+#define DUAL_HASH_TABLE_F_CACHED_HASH   0x02U
+/* 增删时维护每个桶的链长和链长直方图, 供dual_hash_table_stats使用 */
+#define DUAL_HASH_TABLE_F_STATS         0x04U
+
+#define DUAL_HASH_TABLE_REHASH_STEP     4U
+
+/* 链长直方图的项数, 最后一项统计链长不小于该项下标的桶 */
+#define DUAL_HASH_TABLE_HISTOGRAM_SIZE  16U
+
+/* 批量查找时一轮预取的个数 */
+#define DUAL_HASH_TABLE_BULK_MAX        32U
 
 typedef struct {
     unsigned char using_index;
-    unsigned int index_mask;
+    unsigned char flags;
+    unsigned int index_mask;        /* table[using_index]的下标掩码 */
+    unsigned int last_mask;         /* table[using_index ^ 1]的下标掩码 */
+    unsigned int rehash_index;      /* 旧表中下一个待迁移的桶 */
+    unsigned int count[2];          /* 两张表中的元素个数 */
     hash_table_index_func_t hash;
     hash_table_release_func_t release;
     struct hlist_head *table[2];
+    unsigned int *chain_len[2];     /* 每个桶的链长, 仅DUAL_HASH_TABLE_F_STATS */
+    unsigned int histogram[2][DUAL_HASH_TABLE_HISTOGRAM_SIZE];
 } dual_hash_table_t;
 
+typedef struct {
+    unsigned int buckets[2];        /* 两张表的桶数, 表不存在时为0 */
+    unsigned int count[2];          /* 两张表中的元素个数 */
+    unsigned int max_chain;         /* 最长的链, 不超过DUAL_HASH_TABLE_HISTOGRAM_SIZE - 1 */
+    double mean_chain;              /* 非空桶的平均链长 */
+    double load_factor;             /* using表的负载因子 */
+    unsigned int histogram[2][DUAL_HASH_TABLE_HISTOGRAM_SIZE];  /* 链长为i的桶数 */
+} dual_hash_table_stats_t;
+
 extern dual_hash_table_t *dual_hash_table_create(const unsigned int size,
                             const hash_table_index_func_t func,
                             const hash_table_release_func_t release);
 
+extern dual_hash_table_t *dual_hash_table_create_ex(const unsigned int size,
+                            const hash_table_index_func_t func,
+                            const hash_table_release_func_t release,
+                            const unsigned int flags);
+
 extern bool dual_hash_table_add_using(dual_hash_table_t *__restrict t,
                 struct hlist_node *__restrict node);
 
+/* 调用者已经算好了节点的hash, 插入时不再调用hash回调 */
+extern bool dual_hash_table_add_using_hash(dual_hash_table_t *__restrict t,
+                struct hlist_node *__restrict node, const unsigned int hash);
+
+/*
+ * 从表中摘除节点, 不调用release; 按节点当前的hash定位所在的桶, 所以键在节点入表后不能改变,
+ * 不在表中或已经删除的节点直接忽略, 返回false
+ */
+extern bool dual_hash_table_del(dual_hash_table_t *__restrict t,
+                struct hlist_node *__restrict node);
+
 static inline bool dual_hash_table_switch_node(dual_hash_table_t *__restrict t,
                     struct hlist_node *__restrict node)
 {
-    hlist_del(node);
+    dual_hash_table_del(t, node);
     return dual_hash_table_add_using(t, node);
 }
 
+/* 自动扩容模式下由迁移过程负责切换, 这里不做任何事 */
 static inline void dual_hash_table_switch_table(dual_hash_table_t *__restrict t)
 {
+    unsigned int mask;
+
+    if (t->flags & DUAL_HASH_TABLE_F_GROWABLE)
+        return;
+
+    mask = t->index_mask;
+    t->index_mask = t->last_mask;
+    t->last_mask = mask;
     t->using_index ^= 1;
 }
 
+static inline bool dual_hash_table_rehashing(const dual_hash_table_t *__restrict t)
+{
+    return (t->flags & DUAL_HASH_TABLE_F_GROWABLE) && t->table[t->using_index ^ 1];
+}
+
 extern struct hlist_node *dual_hash_table_find_using(dual_hash_table_t *__restrict t,
                             const unsigned int index);
 
+/* 按hash和键查找, equal为NULL时只比较hash */
+extern struct hlist_node *dual_hash_table_find_key(dual_hash_table_t *__restrict t,
+                            const unsigned int hash, const void *__restrict key,
+                            const hash_table_equal_func_t equal);
+
+/**
+ * @brief dual_hash_table_find_bulk 批量查找, 语义与逐个调用dual_hash_table_find_key相同
+ * @param hashes n个待查找的hash
+ * @param keys n个键, 为NULL时只比较hash
+ * @param nodes 返回n个查找结果, 没找到的为NULL
+ * @return 返回找到的个数
+ */
+extern unsigned int dual_hash_table_find_bulk(dual_hash_table_t *__restrict t,
+                    const unsigned int *__restrict hashes, const void *const *__restrict keys,
+                    const hash_table_equal_func_t equal, const unsigned int n,
+                    struct hlist_node **__restrict nodes);
+
 extern struct hlist_node *dual_hash_table_find_last(dual_hash_table_t *__restrict t,
                             const unsigned int index);
 
+/* 元素个数总是可用, 链长相关的统计需要DUAL_HASH_TABLE_F_STATS */
+extern bool dual_hash_table_stats(const dual_hash_table_t *__restrict t,
+                dual_hash_table_stats_t *__restrict stats);
+
 extern void dual_hash_table_destory(dual_hash_table_t *__restrict t);
 
 #endif /* _BASIC_LIB_HASH_TABLE_H_ */
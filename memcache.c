@@ -1,62 +1,573 @@
 ﻿#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
 #include <pthread.h>
+#include <sys/mman.h>
 #include "list.h"
 #include "rbtree.h"
 #include "memcache.h"
 
+/* 每个线程每种大小最多缓存的对象个数, 空了或满了才访问共享的rbtree */
+#define MEMCACHE_MAGAZINE_SIZE      32U
+#define MEMCACHE_MAGAZINE_SLOTS     64U
+
+/*
+ * MEMCACHE_F_SIZE_CLASS模式下的大小分级: 128字节以内按16字节分级,
+ * 之后每个2的幂区间分4级, 内部浪费不超过25%, 超过MEMCACHE_CLASS_MAX的按实际大小缓存
+ */
+#define MEMCACHE_SMALL_CLASSES      8U
+#define MEMCACHE_SMALL_MAX          128U
+#define MEMCACHE_CLASS_MAX          65536U
+#define MEMCACHE_NR_CLASSES         (MEMCACHE_SMALL_CLASSES + 4U * 9U)
+#define MEMCACHE_CLASS_TAB_MAX      1024U
+
+/* MEMCACHE_F_SLAB模式下slab的大小范围, 每个slab按自身大小对齐, 至少容纳MEMCACHE_SLAB_MIN_OBJS个对象 */
+#define MEMCACHE_SLAB_MIN           0x00010000U /* 64K Bytes */
+#define MEMCACHE_SLAB_MAX           0x00200000U /* 2M Bytes */
+#define MEMCACHE_SLAB_MIN_OBJS      8U
+#define MEMCACHE_SLAB_ALIGN         16U
+
+/* MEMCACHE_F_PROFILE模式下每个线程每分配这么多次采样一次调用点 */
+#define MEMCACHE_PROFILE_PERIOD     1024U
+#define MEMCACHE_PROFILE_SITES      64U
+
+struct memcache_root;
+
 struct memcache_list {
     size_t alloc_size;
+    struct memcache_root *root;
     struct rb_node rb;
     struct hlist_head using;
     struct hlist_head cached;
+    void *remote;                   /* 其他线程归还的对象, 经对象首字串成的无锁栈, 持锁时整体取走 */
+    size_t remote_count;            /* remote栈上的对象个数, 只用于统计 */
+    bool untracked;                 /* 对象头只有list一个字, 不挂using/cached链表, 由slab管理 */
+    void *freelist;                 /* untracked时缓存的对象, 经对象首字串成链 */
+    size_t cached_count;            /* 缓存的对象个数, 不含弹匣和remote栈中的 */
+    uint64_t touched_ms;            /* 最近一次从这个链表分配或者衰减的时间 */
+    uint64_t allocs;                /* 弹匣中未汇总的计数不在这里, 无锁汇总时原子相加 */
+    uint64_t frees;
+    uint64_t misses;                /* 新建对象的次数, 需要持有root->mutex */
+    size_t nr_objs;                 /* 尚未归还给系统的对象个数, 需要持有root->mutex */
+    unsigned int stat_index;        /* memcache_stats时在结果中的下标 */
+    struct list_head retired;       /* 被memcache_clear删除后挂在root->retired上, 同样大小再次使用时复用 */
+    size_t slab_size;               /* 为0表示对象逐个malloc */
+    size_t slab_first;              /* 第一个对象在slab中的偏移 */
+    size_t slab_stride;             /* 相邻对象的间隔 */
+    unsigned int slab_objs;         /* 每个slab能切出的对象个数 */
+    struct list_head slabs;
+    struct memcache_slab *current;  /* 还有未切分空间的slab */
 };
 
-struct memcache_node {
+/* slab头部, 对象从slab_first开始依次切出 */
+struct memcache_slab {
     struct memcache_list *list;
+    struct list_head link;
+    unsigned int carved;            /* 已经切出的对象个数 */
+    unsigned int inuse;             /* 不在cached链表上的对象个数 */
+};
+
+/* list紧挨着数据区, untracked的链表对象头只保留list */
+struct memcache_node {
     struct hlist_node node;
+    struct memcache_list *list;
     char data[0];
 };
 
+/* 线程私有的对象弹匣, 弹匣中的对象仍挂在list->using上或计入slab->inuse */
+struct memcache_magazine {
+    size_t size;                    /* 为0表示未使用 */
+    struct memcache_list *list;     /* 链表只会退役不会释放, 一直可以访问 */
+    unsigned int count;
+    uint64_t allocs;                /* 还没有汇总到list的计数, 只有所属线程修改 */
+    uint64_t frees;
+    void *objs[MEMCACHE_MAGAZINE_SIZE];
+};
+
+struct memcache_thread {
+    struct memcache_root *root;
+    struct list_head link;
+    unsigned int samples;           /* 距离上一次调用点采样的分配次数 */
+    struct memcache_magazine mags[MEMCACHE_MAGAZINE_SLOTS];
+};
+
 struct memcache_root {
     pthread_mutex_t mutex;
+    pthread_key_t key;
+    unsigned int flags;
     struct rb_root root;
+    struct list_head threads;
+    struct memcache_list *classes[MEMCACHE_NR_CLASSES];
+    struct memcache_policy policy;
+    uint64_t trim_ms;               /* 下一次顺带做衰减的时间 */
+    struct list_head retired;
+    struct memcache_site sites[MEMCACHE_PROFILE_SITES];
 };
 
-memcache_t memcache_create(void)
+static pthread_once_t memcache_class_once = PTHREAD_ONCE_INIT;
+static unsigned char memcache_class_tab[(MEMCACHE_CLASS_TAB_MAX >> 4) + 1];
+static size_t memcache_class_size[MEMCACHE_NR_CLASSES];
+
+static unsigned int memcache_size_class_slow(const size_t size)
+{
+    size_t n;
+    unsigned int k;
+
+    if (size <= MEMCACHE_SMALL_MAX)
+        return size ? (unsigned int) ((size + 15) >> 4) - 1 : 0;
+
+    n = size - 1;
+    k = sizeof(unsigned long) * 8 - 1 - __builtin_clzl(n);
+
+    return MEMCACHE_SMALL_CLASSES + (k - 7) * 4 + ((n >> (k - 2)) & 3);
+}
+
+static void memcache_class_init(void)
+{
+    unsigned int i;
+    unsigned int k;
+
+    for (i = 0; i < MEMCACHE_NR_CLASSES; i++) {
+        if (i < MEMCACHE_SMALL_CLASSES) {
+            memcache_class_size[i] = (i + 1) << 4;
+        } else {
+            k = 7 + (i - MEMCACHE_SMALL_CLASSES) / 4;
+            memcache_class_size[i] = ((size_t) 1 << k)
+                + ((size_t) ((i - MEMCACHE_SMALL_CLASSES) % 4 + 1) << (k - 2));
+        }
+    }
+
+    for (i = 0; i < sizeof(memcache_class_tab); i++)
+        memcache_class_tab[i] = memcache_size_class_slow(i << 4);
+}
+
+/* 小对象查表, 大对象用移位算出级别, 不遍历rbtree */
+static inline unsigned int memcache_size_class(const size_t size)
+{
+    if (size <= MEMCACHE_CLASS_TAB_MAX)
+        return memcache_class_tab[(size + 15) >> 4];
+
+    return memcache_size_class_slow(size);
+}
+
+static inline bool memcache_use_class(const struct memcache_root *root, const size_t size)
+{
+    return (root->flags & MEMCACHE_F_SIZE_CLASS) && size <= MEMCACHE_CLASS_MAX;
+}
+
+static inline struct memcache_magazine *memcache_magazine_get(struct memcache_thread *tc,
+                    const size_t size)
+{
+    if (memcache_use_class(tc->root, size))
+        return tc->mags + memcache_size_class(size);
+
+    return tc->mags + ((size >> 3) & (MEMCACHE_MAGAZINE_SLOTS - 1));
+}
+
+static inline struct memcache_node *memcache_ptr_node(void *ptr)
+{
+    return (struct memcache_node *) ((char *) ptr - offsetof(struct memcache_node, data));
+}
+
+static inline struct memcache_list *memcache_ptr_list(const void *ptr)
+{
+    return ((struct memcache_list * const *) ptr)[-1];
+}
+
+static inline struct memcache_slab *memcache_ptr_slab(const struct memcache_list *list,
+                    const void *ptr)
+{
+    return (struct memcache_slab *) ((uintptr_t) ptr & ~((uintptr_t) list->slab_size - 1));
+}
+
+static inline void *memcache_slab_obj(const struct memcache_slab *slab, const unsigned int i)
+{
+    return (char *) slab + slab->list->slab_first + i * slab->list->slab_stride;
+}
+
+/* 从缓存中取出一个对象, 没有则返回NULL, 需要持有root->mutex */
+static inline void *memcache_list_take(struct memcache_list *list)
+{
+    void *ptr;
+    struct memcache_node *mem;
+
+    if (list->untracked) {
+        ptr = list->freelist;
+        if (!ptr)
+            return NULL;
+        list->freelist = *(void **) ptr;
+    } else {
+        if (hlist_empty(&list->cached))
+            return NULL;
+        mem = hlist_entry(list->cached.first, struct memcache_node, node);
+        hlist_del(&mem->node);
+        hlist_add_head(&mem->node, &list->using);
+        ptr = mem->data;
+    }
+
+    list->cached_count--;
+    if (list->slab_size)
+        memcache_ptr_slab(list, ptr)->inuse++;
+
+    return ptr;
+}
+
+/* 对象放回缓存, 需要持有root->mutex */
+static inline void memcache_list_put(struct memcache_list *list, void *ptr)
+{
+    struct memcache_node *mem;
+
+    if (list->untracked) {
+        *(void **) ptr = list->freelist;
+        list->freelist = ptr;
+    } else {
+        mem = memcache_ptr_node(ptr);
+        hlist_del(&mem->node);
+        hlist_add_head(&mem->node, &list->cached);
+    }
+
+    list->cached_count++;
+    if (list->slab_size)
+        memcache_ptr_slab(list, ptr)->inuse--;
+}
+
+/* 把弹匣顶部的count个对象放回各自的缓存, 需要持有root->mutex */
+static void memcache_magazine_flush(struct memcache_magazine *mag, unsigned int count)
+{
+    void *ptr;
+
+    while (count-- && mag->count) {
+        ptr = mag->objs[--mag->count];
+        memcache_list_put(memcache_ptr_list(ptr), ptr);
+    }
+}
+
+/* 只有所属线程修改的计数, 其他线程在memcache_stats中无锁读取 */
+static inline void memcache_count(uint64_t *counter)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+/* 弹匣换到其他链表之前把计数汇总到原来的链表, 只能由所属线程调用 */
+static void memcache_magazine_fold(struct memcache_magazine *mag)
+{
+    if (!mag->list)
+        return;
+
+    __atomic_fetch_add(&mag->list->allocs, mag->allocs, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&mag->list->frees, mag->frees, __ATOMIC_RELAXED);
+    __atomic_store_n(&mag->allocs, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&mag->frees, 0, __ATOMIC_RELAXED);
+}
+
+static inline void memcache_magazine_set_list(struct memcache_magazine *mag,
+                    struct memcache_list *list)
+{
+    if (mag->list != list) {
+        memcache_magazine_fold(mag);
+        __atomic_store_n(&mag->list, list, __ATOMIC_RELAXED);
+    }
+}
+
+/* 对象已经归还, 数据区的第一个字用来串成链, 多个线程可以同时压栈 */
+static inline void memcache_list_remote_push(struct memcache_list *list, void *first, void *last,
+                    const unsigned int count)
+{
+    void *head;
+
+    __atomic_fetch_add(&list->remote_count, count, __ATOMIC_RELAXED);
+
+    head = __atomic_load_n(&list->remote, __ATOMIC_RELAXED);
+    do {
+        *(void **) last = head;
+    } while (!__atomic_compare_exchange_n(&list->remote, &head, first, true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* 一次取走remote栈上的所有对象放回cached链表, 需要持有root->mutex */
+static void memcache_list_remote_drain(struct memcache_list *list)
+{
+    void *p;
+    void *next;
+
+    p = __atomic_exchange_n(&list->remote, NULL, __ATOMIC_ACQUIRE);
+    for (; p; p = next) {
+        next = *(void **) p;
+        memcache_list_put(list, p);
+        __atomic_fetch_sub(&list->remote_count, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* 把弹匣顶部的count个对象串成一条链压入所属链表的remote栈, 不需要加锁 */
+static void memcache_magazine_remote_flush(struct memcache_magazine *mag, unsigned int count)
+{
+    void *p;
+    void *last;
+    void *first;
+    unsigned int n;
+    struct memcache_list *list;
+
+    if (!count || !mag->count)
+        return;
+
+    if (count > mag->count)
+        count = mag->count;
+
+    list = memcache_ptr_list(mag->objs[mag->count - 1]);
+    first = last = mag->objs[--mag->count];
+    for (n = 1; n < count; n++) {
+        p = mag->objs[--mag->count];
+        *(void **) last = p;
+        last = p;
+    }
+    memcache_list_remote_push(list, first, last, count);
+}
+
+static void memcache_thread_release(void *arg)
+{
+    unsigned int i;
+    struct memcache_root *root;
+    struct memcache_thread *tc;
+
+    tc = (struct memcache_thread *) arg;
+    root = tc->root;
+    pthread_mutex_lock(&root->mutex);
+    for (i = 0; i < MEMCACHE_MAGAZINE_SLOTS; i++) {
+        memcache_magazine_flush(tc->mags + i, MEMCACHE_MAGAZINE_SIZE);
+        memcache_magazine_fold(tc->mags + i);
+    }
+    list_del(&tc->link);
+    pthread_mutex_unlock(&root->mutex);
+    free(tc);
+}
+
+static struct memcache_thread *memcache_thread_get(struct memcache_root *root)
+{
+    struct memcache_thread *tc;
+
+    tc = (struct memcache_thread *) pthread_getspecific(root->key);
+    if (tc)
+        return tc;
+
+    tc = (struct memcache_thread *) calloc(1, sizeof(*tc));
+    if (!tc)
+        return NULL;
+
+    tc->root = root;
+    if (pthread_setspecific(root->key, tc) != 0) {
+        free(tc);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&root->mutex);
+    list_add(&tc->link, &root->threads);
+    pthread_mutex_unlock(&root->mutex);
+
+    return tc;
+}
+
+static uint64_t memcache_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+memcache_t memcache_create_ex(unsigned int flags)
 {
     struct memcache_root *root;
 
-    root = (struct memcache_root *) malloc(sizeof(*root));
+    if (flags & MEMCACHE_F_UNTRACKED)
+        flags |= MEMCACHE_F_SLAB;
+
+    if (flags & MEMCACHE_F_SIZE_CLASS)
+        pthread_once(&memcache_class_once, memcache_class_init);
+
+    root = (struct memcache_root *) calloc(1, sizeof(*root));
     if (root) {
+        if (pthread_key_create(&root->key, memcache_thread_release) != 0) {
+            free(root);
+            return NULL;
+        }
+
+        root->flags = flags;
         root->root = RB_ROOT;
+        INIT_LIST_HEAD(&root->threads);
+        INIT_LIST_HEAD(&root->retired);
         pthread_mutex_init(&root->mutex, NULL);
     }
 
     return root;
 }
 
-void *memcache_alloc(memcache_t cache, const size_t size)
+memcache_t memcache_create(void)
+{
+    return memcache_create_ex(0);
+}
+
+/* 映射一块按size对齐的slab, 大页映射失败时退回普通页 */
+static struct memcache_slab *memcache_slab_map(const size_t size, const bool huge)
+{
+    void *p;
+    uintptr_t addr;
+    uintptr_t aligned;
+
+#if defined (MAP_HUGETLB)
+    if (huge) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+            return (struct memcache_slab *) p;
+    }
+#endif
+
+    p = mmap(NULL, size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    addr = (uintptr_t) p;
+    aligned = (addr + size - 1) & ~((uintptr_t) size - 1);
+    if (aligned != addr)
+        munmap(p, aligned - addr);
+    munmap((void *) (aligned + size), addr + size - aligned);
+
+    return (struct memcache_slab *) aligned;
+}
+
+/* 数据区至少能放下remote栈的链接指针 */
+static inline size_t memcache_list_payload(const struct memcache_list *list)
+{
+    return list->alloc_size < sizeof(void *) ? sizeof(void *) : list->alloc_size;
+}
+
+/* slab_first是第一个对象数据区的偏移, 放不进slab的大对象退回逐个malloc并跟踪 */
+static void memcache_list_slab_init(struct memcache_list *list, const unsigned int flags)
+{
+    size_t size;
+    size_t header;
+    size_t start;
+
+    list->slab_size = 0;
+    list->current = NULL;
+    list->untracked = false;
+    list->freelist = NULL;
+    list->cached_count = 0;
+    list->touched_ms = 0;
+    INIT_LIST_HEAD(&list->slabs);
+    if (!(flags & (MEMCACHE_F_SLAB | MEMCACHE_F_HUGEPAGE)))
+        return;
+
+    header = (flags & MEMCACHE_F_UNTRACKED) ? sizeof(struct memcache_list *) : sizeof(struct memcache_node);
+    list->slab_stride = (header + memcache_list_payload(list) + MEMCACHE_SLAB_ALIGN - 1)
+        & ~((size_t) MEMCACHE_SLAB_ALIGN - 1);
+    list->slab_first = (sizeof(struct memcache_slab) + header + MEMCACHE_SLAB_ALIGN - 1)
+        & ~((size_t) MEMCACHE_SLAB_ALIGN - 1);
+    start = list->slab_first - header;
+    if (start + list->slab_stride * MEMCACHE_SLAB_MIN_OBJS > MEMCACHE_SLAB_MAX)
+        return;
+
+    if (flags & MEMCACHE_F_HUGEPAGE) {
+        size = MEMCACHE_SLAB_MAX;
+    } else {
+        for (size = MEMCACHE_SLAB_MIN; size < start + list->slab_stride * MEMCACHE_SLAB_MIN_OBJS; )
+            size <<= 1;
+    }
+
+    list->slab_size = size;
+    list->slab_objs = (size - start) / list->slab_stride;
+    list->untracked = (flags & MEMCACHE_F_UNTRACKED) != 0;
+}
+
+static struct memcache_list *memcache_list_new(struct memcache_root *root, const size_t size)
+{
+    struct memcache_list *list;
+
+    list = (struct memcache_list *) malloc(sizeof(struct memcache_list));
+    if (list) {
+        list->alloc_size = size;
+        list->root = root;
+        INIT_HLIST_HEAD(&list->using);
+        INIT_HLIST_HEAD(&list->cached);
+        list->remote = NULL;
+        list->remote_count = 0;
+        list->allocs = 0;
+        list->frees = 0;
+        list->misses = 0;
+        list->nr_objs = 0;
+        list->stat_index = UINT_MAX;
+        INIT_LIST_HEAD(&list->retired);
+        memcache_list_slab_init(list, root->flags);
+    }
+
+    return list;
+}
+
+/* 新建一个对象, slab模式下从当前slab中切出, 除untracked外挂到using链表上, 需要持有root->mutex */
+static void *memcache_obj_new(struct memcache_list *list)
 {
+    void *ptr;
+    struct memcache_node *mem;
+    struct memcache_slab *slab;
+
+    if (!list->slab_size) {
+        mem = (struct memcache_node *) malloc(sizeof(struct memcache_node) + memcache_list_payload(list));
+        if (!mem)
+            return NULL;
+        ptr = mem->data;
+    } else {
+        slab = list->current;
+        if (!slab || slab->carved == list->slab_objs) {
+            slab = memcache_slab_map(list->slab_size, list->root->flags & MEMCACHE_F_HUGEPAGE);
+            if (!slab)
+                return NULL;
+
+            slab->list = list;
+            slab->carved = 0;
+            slab->inuse = 0;
+            list_add(&slab->link, &list->slabs);
+            list->current = slab;
+        }
+
+        ptr = memcache_slab_obj(slab, slab->carved++);
+        slab->inuse++;
+    }
+
+    ((struct memcache_list **) ptr)[-1] = list;
+    list->misses++;
+    list->nr_objs++;
+    if (!list->untracked)
+        hlist_add_head(&memcache_ptr_node(ptr)->node, &list->using);
+
+    return ptr;
+}
+
+/* 找到size对应的链表, 不存在则创建, 需要持有root->mutex */
+static struct memcache_list *memcache_list_get(struct memcache_root *root, const size_t size)
+{
+    unsigned int c;
     struct rb_node **rb;
     struct rb_node *parent;
-    struct memcache_node *mem;
-    struct memcache_list *list;
-    struct memcache_root *root;
+    struct memcache_list *list, *tmp;
 
-    if (!cache || !size)
-        return NULL;
+    if (memcache_use_class(root, size)) {
+        c = memcache_size_class(size);
+        if (!root->classes[c])
+            root->classes[c] = memcache_list_new(root, memcache_class_size[c]);
+        return root->classes[c];
+    }
 
-    root = (struct memcache_root *) cache;
-    pthread_mutex_lock(&root->mutex);
     parent = NULL;
     rb = &root->root.rb_node;
     while (*rb != NULL) {
         parent = *rb;
         list = rb_entry(parent, struct memcache_list, rb);
         if (list->alloc_size == size) {
-            goto drop_cache;
+            return list;
         } else if (list->alloc_size < size) {
             rb = &parent->rb_left;
         } else {
@@ -64,65 +575,321 @@ void *memcache_alloc(memcache_t cache, const size_t size)
         }
     }
 
-    list = (struct memcache_list *) malloc(sizeof(struct memcache_list));
-    if (!list) {
-        pthread_mutex_unlock(&root->mutex);
-        return NULL;
+    list = NULL;
+    list_for_each_entry(tmp, &root->retired, retired) {
+        if (tmp->alloc_size == size) {
+            list = tmp;
+            list_del_init(&list->retired);
+            break;
+        }
     }
 
-    list->alloc_size = size;
-    INIT_HLIST_HEAD(&list->using);
-    INIT_HLIST_HEAD(&list->cached);
-    rb_insert_color(&list->rb, &root->root);
+    if (!list)
+        list = memcache_list_new(root, size);
+    if (!list)
+        return NULL;
+
     rb_link_node(&list->rb, parent, rb);
-    goto new_node;
+    rb_insert_color(&list->rb, &root->root);
 
-drop_cache:
-    if (!hlist_empty(&list->cached)) {
-        mem = hlist_entry(list->cached.first, struct memcache_node, node);
-        hlist_del(&mem->node);
-        goto finish;        
+    return list;
+}
+
+/*
+ * 归还缓存的对象直到只剩keep个, 返回归还的字节数, 需要持有root->mutex;
+ * slab模式下只能整块归还所有对象都已缓存的slab, 结果可能仍多于keep个
+ */
+static size_t memcache_list_shrink(struct memcache_list *list, const size_t keep)
+{
+    void **pp;
+    size_t bytes;
+    unsigned int i;
+    struct memcache_node *mem;
+    struct memcache_slab *slab, *tmp;
+    LIST_HEAD(victims);
+
+    bytes = 0;
+    if (!list->slab_size) {
+        while (list->cached_count > keep) {
+            mem = hlist_entry(list->cached.first, struct memcache_node, node);
+            hlist_del(&mem->node);
+            free(mem);
+            list->cached_count--;
+            list->nr_objs--;
+            bytes += list->alloc_size;
+        }
+        return bytes;
     }
 
-new_node:
-    mem = (struct memcache_node *) malloc(sizeof(struct memcache_node) + size);
-    if (!mem) {
-        pthread_mutex_unlock(&root->mutex);
-        return NULL;
+    list_for_each_entry_safe(slab, tmp, &list->slabs, link) {
+        if (list->cached_count <= keep)
+            break;
+        if (slab->inuse)
+            continue;
+
+        for (i = 0; !list->untracked && i < slab->carved; i++)
+            hlist_del(&memcache_ptr_node(memcache_slab_obj(slab, i))->node);
+        list_move(&slab->link, &victims);
+        list->cached_count -= slab->carved;
+        list->nr_objs -= slab->carved;
+        if (list->current == slab)
+            list->current = NULL;
+        /* 标记为待归还, 下面据此把它的对象从freelist中摘掉 */
+        slab->list = NULL;
+    }
+
+    if (list->untracked && !list_empty(&victims)) {
+        for (pp = &list->freelist; *pp; ) {
+            if (memcache_ptr_slab(list, *pp)->list)
+                pp = (void **) *pp;
+            else
+                *pp = *(void **) *pp;
+        }
+    }
+
+    list_for_each_entry_safe(slab, tmp, &victims, link) {
+        munmap(slab, list->slab_size);
+        bytes += list->slab_size;
+    }
+
+    return bytes;
+}
+
+/* 收回remote栈, 缓存超过上限的部分归还, 闲置超过decay_ms的链表缓存减半, 需要持有root->mutex */
+static size_t memcache_list_trim(struct memcache_root *root, struct memcache_list *list,
+                const uint64_t now)
+{
+    size_t bytes;
+    size_t limit;
+
+    bytes = 0;
+    memcache_list_remote_drain(list);
+    if (root->policy.max_cached_bytes) {
+        limit = root->policy.max_cached_bytes / list->alloc_size;
+        if (list->cached_count > limit)
+            bytes += memcache_list_shrink(list, limit);
+    }
+
+    if (root->policy.decay_ms && list->cached_count
+            && now - list->touched_ms >= root->policy.decay_ms) {
+        bytes += memcache_list_shrink(list, list->cached_count / 2);
+        list->touched_ms = now;
+    }
+
+    return bytes;
+}
+
+/* 遍历所有链表做一轮trim, 每个链表最多归还一半, 需要持有root->mutex */
+static size_t memcache_trim_locked(struct memcache_root *root, const uint64_t now)
+{
+    size_t bytes;
+    unsigned int i;
+    struct rb_node *rb;
+
+    bytes = 0;
+    for (rb = rb_first(&root->root); rb; rb = rb_next(rb))
+        bytes += memcache_list_trim(root, rb_entry(rb, struct memcache_list, rb), now);
+
+    for (i = 0; i < MEMCACHE_NR_CLASSES; i++) {
+        if (root->classes[i])
+            bytes += memcache_list_trim(root, root->classes[i], now);
+    }
+
+    if (root->policy.decay_ms)
+        root->trim_ms = now + root->policy.decay_ms;
+
+    return bytes;
+}
+
+/* 弹匣为空时从共享链表中补充, 一次取半个弹匣, mag为NULL时只取一个 */
+static void *memcache_alloc_slow(struct memcache_root *root, struct memcache_magazine *mag,
+                const size_t size)
+{
+    void *ptr;
+    uint64_t now;
+    struct memcache_list *list;
+
+    ptr = NULL;
+    now = 0;
+    pthread_mutex_lock(&root->mutex);
+    if (mag && mag->count && mag->size != size)
+        memcache_magazine_flush(mag, mag->count);
+
+    list = memcache_list_get(root, size);
+    if (!list)
+        goto unlock;
+
+    memcache_list_remote_drain(list);
+    if (mag) {
+        mag->size = size;
+        memcache_magazine_set_list(mag, list);
+        while (mag->count < MEMCACHE_MAGAZINE_SIZE / 2 && (ptr = memcache_list_take(list)) != NULL)
+            mag->objs[mag->count++] = ptr;
+
+        if (mag->count) {
+            ptr = mag->objs[--mag->count];
+            goto unlock;
+        }
+    } else {
+        ptr = memcache_list_take(list);
+        if (ptr)
+            goto unlock;
+    }
+
+    ptr = memcache_obj_new(list);
+
+unlock:
+    if (ptr) {
+        if (mag)
+            memcache_count(&mag->allocs);
+        else
+            __atomic_fetch_add(&list->allocs, 1, __ATOMIC_RELAXED);
+    }
+
+    if (list && (root->policy.max_cached_bytes || root->policy.decay_ms)) {
+        /* 顺带执行回收策略: 每次只检查当前链表的上限, 每隔decay_ms才遍历一轮 */
+        if (root->policy.decay_ms) {
+            now = memcache_now_ms();
+            list->touched_ms = now;
+        }
+        if (root->policy.decay_ms && now >= root->trim_ms)
+            memcache_trim_locked(root, now);
+        else if (root->policy.max_cached_bytes)
+            memcache_list_trim(root, list, now);
     }
+    pthread_mutex_unlock(&root->mutex);
+
+    return ptr;
+}
+
+/* 按调用点累计采样次数, 表满后新的调用点被忽略 */
+static void memcache_profile_record(struct memcache_root *root, void *caller, const size_t size)
+{
+    unsigned int i;
+    unsigned int n;
+    struct memcache_site *site;
+
+    i = (unsigned int) (((uintptr_t) caller >> 4) * 0x9e3779b1U);
+    pthread_mutex_lock(&root->mutex);
+    for (n = 0; n < MEMCACHE_PROFILE_SITES; n++, i++) {
+        site = root->sites + (i & (MEMCACHE_PROFILE_SITES - 1));
+        if (!site->caller) {
+            site->caller = caller;
+            site->size = size;
+        }
 
-    mem->list = list;
-finish:
-    hlist_add_head(&mem->node, &list->using);
+        if (site->caller == caller) {
+            site->samples++;
+            break;
+        }
+    }
     pthread_mutex_unlock(&root->mutex);
+}
+
+void *memcache_alloc(memcache_t cache, size_t size)
+{
+    unsigned int c;
+    struct memcache_root *root;
+    struct memcache_thread *tc;
+    struct memcache_magazine *mag;
+
+    if (!cache || !size)
+        return NULL;
 
-    return mem->data;
+    root = (struct memcache_root *) cache;
+    if (memcache_use_class(root, size)) {
+        c = memcache_size_class(size);
+        size = memcache_class_size[c];
+    } else {
+        c = (size >> 3) & (MEMCACHE_MAGAZINE_SLOTS - 1);
+    }
+
+    tc = memcache_thread_get(root);
+    if (!tc)
+        return memcache_alloc_slow(root, NULL, size);
+
+    if ((root->flags & MEMCACHE_F_PROFILE) && ++tc->samples >= MEMCACHE_PROFILE_PERIOD) {
+        tc->samples = 0;
+        memcache_profile_record(root, __builtin_return_address(0), size);
+    }
+
+    mag = tc->mags + c;
+    if (mag->count && mag->size == size) {
+        memcache_count(&mag->allocs);
+        return mag->objs[--mag->count];
+    }
+
+    return memcache_alloc_slow(root, mag, size);
 }
 
 void memcache_free(void *ptr)
 {
-    struct memcache_node *mem;
+    struct memcache_list *list;
+    struct memcache_root *root;
+    struct memcache_thread *tc;
+    struct memcache_magazine *mag;
 
-    if (ptr) {
-        mem = container_of(ptr, struct memcache_node, data);
-        hlist_del(&mem->node);
-        hlist_add_head(&mem->node, &mem->list->cached);
+    if (!ptr)
+        return;
+
+    list = memcache_ptr_list(ptr);
+    root = list->root;
+    tc = memcache_thread_get(root);
+    if (!tc) {
+        __atomic_fetch_add(&list->frees, 1, __ATOMIC_RELAXED);
+        memcache_list_remote_push(list, ptr, ptr, 1);
+        return;
     }
+
+    mag = memcache_magazine_get(tc, list->alloc_size);
+    if (mag->size != list->alloc_size || mag->count == MEMCACHE_MAGAZINE_SIZE) {
+        /* 弹匣被其他大小占用或者已满, 腾出的对象交给链表的remote栈, 由下次补充弹匣的线程收回 */
+        if (mag->size != list->alloc_size)
+            memcache_magazine_remote_flush(mag, mag->count);
+        else
+            memcache_magazine_remote_flush(mag, MEMCACHE_MAGAZINE_SIZE / 2);
+        mag->size = list->alloc_size;
+    }
+
+    memcache_magazine_set_list(mag, list);
+    memcache_count(&mag->frees);
+    mag->objs[mag->count++] = ptr;
 }
 
 static void memcache_list_release(struct hlist_head *head)
 {
-    struct hlist_node *n;
+    struct hlist_node *n, *tmp;
     struct memcache_node *node;
 
-    hlist_for_each_entry(node, n, head, node)
+    hlist_for_each_entry_safe(node, n, tmp, head, node)
         free(node);
 
     INIT_HLIST_HEAD(head);
 }
 
+static void memcache_list_destroy(struct memcache_list *list)
+{
+    struct memcache_slab *slab, *tmp;
+
+    if (!list->slab_size) {
+        memcache_list_release(&list->cached);
+        memcache_list_release(&list->using);
+    } else {
+        list_for_each_entry_safe(slab, tmp, &list->slabs, link)
+            munmap(slab, list->slab_size);
+    }
+    free(list);
+}
+
+/* 没有未归还的对象 */
+static inline bool memcache_list_idle(const struct memcache_list *list)
+{
+    return list->untracked ? list_empty(&list->slabs) : hlist_empty(&list->using);
+}
+
 void memcache_clear(memcache_t cache, bool del_empty_list)
 {
+    unsigned int i;
     struct rb_node *rb;
     struct memcache_list *list;
     struct memcache_root *root;
@@ -133,32 +900,181 @@ void memcache_clear(memcache_t cache, bool del_empty_list)
         for (rb = rb_first(&root->root); rb;) {
             list = rb_entry(rb, struct memcache_list, rb);
             rb = rb_next(rb);
-            memcache_list_release(&list->cached);
-            if (del_empty_list && hlist_empty(&list->using)) {
+            memcache_list_remote_drain(list);
+            memcache_list_shrink(list, 0);
+            if (del_empty_list && memcache_list_idle(list)) {
+                /* 其他线程的弹匣可能还指向这个链表, 只能退役不能释放 */
                 rb_erase(&list->rb, &root->root);
-                free(list);
+                list_add(&list->retired, &root->retired);
+            }
+        }
+
+        /* 分级链表的数量有上限, 空了也保留 */
+        for (i = 0; i < MEMCACHE_NR_CLASSES; i++) {
+            if (root->classes[i]) {
+                memcache_list_remote_drain(root->classes[i]);
+                memcache_list_shrink(root->classes[i], 0);
             }
         }
         pthread_mutex_unlock(&root->mutex);
     }
 }
 
+static void memcache_list_stats(struct memcache_list *list, struct memcache_stats *stats,
+                const size_t n, const unsigned int index)
+{
+    list->stat_index = index;
+    if (index >= n)
+        return;
+
+    stats[index].size = list->alloc_size;
+    stats[index].allocs = __atomic_load_n(&list->allocs, __ATOMIC_RELAXED);
+    stats[index].frees = __atomic_load_n(&list->frees, __ATOMIC_RELAXED);
+    stats[index].misses = list->misses;
+    stats[index].cached_bytes = (list->cached_count
+        + __atomic_load_n(&list->remote_count, __ATOMIC_RELAXED)) * list->alloc_size;
+    stats[index].inuse_bytes = list->nr_objs * list->alloc_size;
+}
+
+/*
+ * 持锁期间只复制链表的计数和各线程弹匣中未汇总的计数, 不遍历对象;
+ * 所属线程同时在更新计数, 结果是近似值
+ */
+size_t memcache_stats(memcache_t cache, struct memcache_stats *stats, size_t n)
+{
+    size_t i;
+    unsigned int count;
+    struct rb_node *rb;
+    struct memcache_root *root;
+    struct memcache_thread *tc;
+    struct memcache_list *list;
+    struct memcache_magazine *mag;
+
+    if (!cache)
+        return 0;
+
+    if (!stats)
+        n = 0;
+
+    root = (struct memcache_root *) cache;
+    count = 0;
+    pthread_mutex_lock(&root->mutex);
+    for (i = 0; i < MEMCACHE_NR_CLASSES; i++) {
+        if (root->classes[i])
+            memcache_list_stats(root->classes[i], stats, n, count++);
+    }
+
+    for (rb = rb_first(&root->root); rb; rb = rb_next(rb))
+        memcache_list_stats(rb_entry(rb, struct memcache_list, rb), stats, n, count++);
+
+    list_for_each_entry(list, &root->retired, retired)
+        list->stat_index = UINT_MAX;
+
+    list_for_each_entry(tc, &root->threads, link) {
+        for (i = 0; i < MEMCACHE_MAGAZINE_SLOTS; i++) {
+            mag = tc->mags + i;
+            list = __atomic_load_n(&mag->list, __ATOMIC_RELAXED);
+            if (!list || list->stat_index >= n)
+                continue;
+
+            stats[list->stat_index].allocs += __atomic_load_n(&mag->allocs, __ATOMIC_RELAXED);
+            stats[list->stat_index].frees += __atomic_load_n(&mag->frees, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&root->mutex);
+
+    for (i = 0; i < n && i < count; i++) {
+        stats[i].hits = stats[i].allocs > stats[i].misses ? stats[i].allocs - stats[i].misses : 0;
+        stats[i].inuse_bytes = stats[i].inuse_bytes > stats[i].cached_bytes
+            ? stats[i].inuse_bytes - stats[i].cached_bytes : 0;
+    }
+
+    return count;
+}
+
+size_t memcache_profile(memcache_t cache, struct memcache_site *sites, size_t n)
+{
+    size_t count;
+    unsigned int i;
+    struct memcache_root *root;
+
+    if (!cache)
+        return 0;
+
+    root = (struct memcache_root *) cache;
+    count = 0;
+    pthread_mutex_lock(&root->mutex);
+    for (i = 0; i < MEMCACHE_PROFILE_SITES; i++) {
+        if (!root->sites[i].caller)
+            continue;
+
+        if (sites && count < n)
+            sites[count] = root->sites[i];
+        count++;
+    }
+    pthread_mutex_unlock(&root->mutex);
+
+    return count;
+}
+
+void memcache_set_policy(memcache_t cache, const struct memcache_policy *policy)
+{
+    struct memcache_root *root;
+
+    if (cache && policy) {
+        root = (struct memcache_root *) cache;
+        pthread_mutex_lock(&root->mutex);
+        root->policy = *policy;
+        root->trim_ms = 0;
+        pthread_mutex_unlock(&root->mutex);
+    }
+}
+
+size_t memcache_trim(memcache_t cache)
+{
+    size_t bytes;
+    struct memcache_root *root;
+
+    if (!cache)
+        return 0;
+
+    root = (struct memcache_root *) cache;
+    pthread_mutex_lock(&root->mutex);
+    bytes = memcache_trim_locked(root, root->policy.decay_ms ? memcache_now_ms() : 0);
+    pthread_mutex_unlock(&root->mutex);
+
+    return bytes;
+}
+
 void memcache_destroy(memcache_t cache)
 {
+    unsigned int i;
     struct rb_node *rb;
     struct memcache_list *list;
     struct memcache_root *root;
+    struct memcache_thread *tc, *tmp;
+    struct memcache_list *tmp_list;
 
     if (cache) {
         root = (struct memcache_root *) cache;
+        pthread_key_delete(root->key);
         pthread_mutex_destroy(&root->mutex);
+        /* 弹匣中的对象都还挂在using链表上或者属于某个slab, 随链表一起释放 */
+        list_for_each_entry_safe(tc, tmp, &root->threads, link)
+            free(tc);
         for (rb = rb_first(&root->root); rb;) {
             list = rb_entry(rb, struct memcache_list, rb);
             rb = rb_next(rb);
             rb_erase(&list->rb, &root->root);
-            memcache_list_release(&list->cached);
-            memcache_list_release(&list->using);
-            free(list);
+            memcache_list_destroy(list);
+        }
+
+        list_for_each_entry_safe(list, tmp_list, &root->retired, retired)
+            memcache_list_destroy(list);
+
+        for (i = 0; i < MEMCACHE_NR_CLASSES; i++) {
+            if (root->classes[i])
+                memcache_list_destroy(root->classes[i]);
         }
         free(root);
     }
@@ -6,14 +6,66 @@
 
 typedef void *memcache_t;
 
+/* 缓存回收策略, 弹匣和remote栈中的对象不计入 */
+struct memcache_policy {
+    size_t max_cached_bytes;        /* 每个大小(级别)缓存的字节数上限, 0表示不限 */
+    unsigned int decay_ms;          /* 链表闲置超过decay_ms后每隔decay_ms缓存减半, 0表示不衰减 */
+};
+
+/* 每个大小(级别)一项, 分配次数 = hits + misses */
+struct memcache_stats {
+    size_t size;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t hits;                  /* 从弹匣或共享缓存中取到对象 */
+    uint64_t misses;                /* 新建对象: malloc或者从slab中切出 */
+    size_t cached_bytes;            /* 共享缓存和remote栈中的字节数 */
+    size_t inuse_bytes;             /* 其余字节数, 包括线程弹匣中的对象 */
+};
+
+struct memcache_site {
+    void *caller;                   /* 调用memcache_alloc的返回地址 */
+    size_t size;                    /* 第一次采样时的申请大小 */
+    uint64_t samples;
+};
+
+/* 按大小分级缓存, 申请大小向上取整到所属级别, 链表个数有上限 */
+#define MEMCACHE_F_SIZE_CLASS   0x01U
+/* 对象从64K到2M的slab中切出, memcache_clear整块归还空闲的slab */
+#define MEMCACHE_F_SLAB         0x02U
+/* 在MEMCACHE_F_SLAB的基础上使用2M的大页(MAP_HUGETLB), 失败时退回普通页 */
+#define MEMCACHE_F_HUGEPAGE     0x04U
+/*
+ * 隐含MEMCACHE_F_SLAB, 不再用using/cached链表跟踪每个对象, 对象头从三个字减为一个字,
+ * 未归还的对象随所属slab在memcache_destroy时释放; 放不进slab的大对象仍逐个跟踪
+ */
+#define MEMCACHE_F_UNTRACKED    0x08U
+/* 每个线程每分配1024次采样一次调用点, 用memcache_profile读取 */
+#define MEMCACHE_F_PROFILE      0x10U
+
 extern memcache_t memcache_create(void);
 
+extern memcache_t memcache_create_ex(const unsigned int flags);
+
 extern void *memcache_alloc(memcache_t cache, size_t size);
 
+/* 可以在任意线程调用, 不加锁: 先放回当前线程的弹匣, 弹匣满了放入对应链表的无锁remote栈 */
 extern void memcache_free(void *ptr);
 
 extern void memcache_clear(memcache_t cache, bool del_empty_list);
 
+/* 分配的慢路径会顺带按策略回收, 空闲时没有分配则需要定时调用memcache_trim */
+extern void memcache_set_policy(memcache_t cache, const struct memcache_policy *policy);
+
+/* 按策略归还一轮缓存, 不会一次清空, 返回归还给系统的字节数 */
+extern size_t memcache_trim(memcache_t cache);
+
+/* 最多填写n项, 返回大小(级别)的总个数, 可以先传NULL取得个数 */
+extern size_t memcache_stats(memcache_t cache, struct memcache_stats *stats, size_t n);
+
+/* 最多填写n个调用点, 返回已采样的调用点个数 */
+extern size_t memcache_profile(memcache_t cache, struct memcache_site *sites, size_t n);
+
 /* ! stop other threads and then can invoke this function */
 extern void memcache_destroy(memcache_t cache);
 
@@ -1,80 +1,170 @@
 ﻿#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
 #include "port_memory.h"
 
-#if (!defined (_WIN32) && !defined (__linux__)) || (defined (ENABLE_MEMORY_POOL) && (ENABLE_MEMORY_POOL != 0U))
+#if !defined (_WIN32) || (defined (ENABLE_MEMORY_POOL) && (ENABLE_MEMORY_POOL != 0U))
+
+#if defined (__linux__)
+#include <pthread.h>
+#endif
 
 struct heap_block_link {
     struct heap_block_link *next_free_block;    /* 表中的下一块空闲块 */
     size_t block_size;                          /* 当前空闲块的大小 */
 };
 
-#define HEAP_MINIMUM_BLOCK_SIZE     0x000000002 /* 8 Bytes */
 #define HEAP_BITS_PER_BYTE          8
 #define HEAP_BYTE_ALIGNMENT         8           /* 8字节对齐 */
 #define HEAP_BYTE_ALIGNMENT_MASK    0x000000007 /* 掩码 */
 #define HEAP_STRUCTURE_SIZE                                                     \
         ((sizeof(struct heap_block_link) + ((size_t)(HEAP_BYTE_ALIGNMENT - 1))) \
             & ~(HEAP_BYTE_ALIGNMENT_MASK))
+#define HEAP_MINIMUM_BLOCK_SIZE     (HEAP_STRUCTURE_SIZE << 1) /* 剩余部分至少能放下块头才拆分 */
+#define HEAP_BLOCK_ALLOCATED_BIT    (((size_t)1) << ((sizeof(size_t) * HEAP_BITS_PER_BYTE) - 1))
+
+/*
+ * MEM_HEAP_F_TLSF模式: 两级分离适配, 第一级按2的幂, 第二级把每个2的幂区间等分为TLSF_SL_COUNT份,
+ * 小于TLSF_SMALL_BLOCK_SIZE的块按8字节线性分级, 用位图一次找到非空的链表, 申请和释放都是O(1)
+ */
+#define TLSF_SL_LOG2                4
+#define TLSF_SL_COUNT               (1U << TLSF_SL_LOG2)
+#define TLSF_FL_SHIFT               (TLSF_SL_LOG2 + 3)
+#define TLSF_FL_COUNT               (sizeof(size_t) * HEAP_BITS_PER_BYTE - TLSF_FL_SHIFT + 1)
+#define TLSF_SMALL_BLOCK_SIZE       ((size_t)1 << TLSF_FL_SHIFT)
+#define TLSF_BLOCK_FREE             ((size_t)1) /* 块大小按8字节对齐, 最低位用作空闲标志 */
+#define TLSF_BLOCK_SIZE_MASK        (~((size_t)HEAP_BYTE_ALIGNMENT_MASK))
+#define TLSF_MINIMUM_BLOCK_SIZE     sizeof(struct tlsf_block)
+
+/* 块头与heap_block_link一样大, 空闲时在数据区中保存空闲链表的指针 */
+struct tlsf_block {
+    struct tlsf_block *prev_phys_block;         /* 物理上的前一块, 第一块为NULL */
+    size_t block_size;                          /* 包括块头, 最低位是空闲标志 */
+    struct tlsf_block *next_free_block;
+    struct tlsf_block *prev_free_block;
+};
 
-/**内存池的地址和大小**/
-#if !defined (HEAP_AVAILABLE_SIZE)
-#define HEAP_AVAILABLE_SIZE         0x000800000 /* 8M Bytes */
+struct heap_tlsf {
+    size_t fl_bitmap;
+    unsigned int sl_bitmap[TLSF_FL_COUNT];
+    struct tlsf_block *blocks[TLSF_FL_COUNT][TLSF_SL_COUNT];
+};
+
+struct mem_heap {
+    struct heap_block_link block_start;
+    struct heap_block_link *block_end;
+    size_t free_bytes_remaining;
+    size_t minimum_ever_free_bytes_remaining;
+    unsigned int flags;
+    struct heap_tlsf *tlsf;                     /* 非TLSF模式为NULL */
+    uint64_t alloc_calls;                       /* 以下只在MEM_HEAP_F_TIMING时统计 */
+    uint64_t alloc_cycles;
+    uint64_t alloc_cycles_max;
+    uint64_t free_calls;
+    uint64_t free_cycles;
+    uint64_t free_cycles_max;
+#if defined (__linux__)
+    union {
+        pthread_mutex_t mutex;
+        pthread_spinlock_t spin;
+    } lock;
 #endif
+};
 
-#if !defined (HEAP_ADDRESS)
-static char port_memory_address[HEAP_AVAILABLE_SIZE];
-#define HEAP_ADDRESS                ((void *)port_memory_address)
+#define HEAP_CONTROL_SIZE                                                       \
+        ((sizeof(struct mem_heap) + ((size_t)(HEAP_BYTE_ALIGNMENT - 1)))        \
+            & ~(HEAP_BYTE_ALIGNMENT_MASK))
+#define HEAP_TLSF_SIZE                                                          \
+        ((sizeof(struct heap_tlsf) + ((size_t)(HEAP_BYTE_ALIGNMENT - 1)))       \
+            & ~(HEAP_BYTE_ALIGNMENT_MASK))
+
+static inline void static_heap_lock(struct mem_heap *heap)
+{
+#if defined (__linux__)
+    if (heap->flags & MEM_HEAP_F_SPIN)
+        pthread_spin_lock(&heap->lock.spin);
+    else if (heap->flags & MEM_HEAP_F_MUTEX)
+        pthread_mutex_lock(&heap->lock.mutex);
+#else
+    // suspend all tasks
+    (void)heap;
+#endif
+}
+
+static inline void static_heap_unlock(struct mem_heap *heap)
+{
+#if defined (__linux__)
+    if (heap->flags & MEM_HEAP_F_SPIN)
+        pthread_spin_unlock(&heap->lock.spin);
+    else if (heap->flags & MEM_HEAP_F_MUTEX)
+        pthread_mutex_unlock(&heap->lock.mutex);
+#else
+    // resume all tasks
+    (void)heap;
 #endif
+}
 
-static struct heap_block_link heap_block_start, *heap_block_end = NULL;
-static size_t heap_free_bytes_remaining = 0U;
-static size_t heap_minimum_ever_free_bytes_remaining = 0U;
-static size_t heap_block_allocated_bit = 0;
+static inline uint64_t static_heap_cycles(void)
+{
+#if defined (__x86_64__) || defined (__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined (__aarch64__)
+    uint64_t cnt;
+
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (cnt));
+    return cnt;
+#else
+    return 0;
+#endif
+}
 
-/* 堆初始化, 在第一次内存分配前需要先运行该函数 */
-static void static_heap_init(void *pool, const size_t size)
+/* 需要持有锁 */
+static inline void static_heap_account(uint64_t *calls, uint64_t *total, uint64_t *max, const uint64_t start)
 {
+    uint64_t cycles;
 
+    cycles = static_heap_cycles() - start;
+    (*calls)++;
+    *total += cycles;
+    if (cycles > *max) {
+        *max = cycles;
+    }
+}
+
+/* 堆初始化, pool已经按HEAP_BYTE_ALIGNMENT对齐 */
+static void static_heap_init(struct mem_heap *heap, void *pool, const size_t size)
+{
     size_t address;
-    size_t total_heap_size;
     unsigned char *puc_aligned_heap;
     struct heap_block_link *pfirst_free_block;
 
-    total_heap_size = size;
-    address = (size_t)pool;
-    if ((address & HEAP_BYTE_ALIGNMENT_MASK) != 0) {
-        address += HEAP_BYTE_ALIGNMENT - 1;
-        address &= ~((size_t)HEAP_BYTE_ALIGNMENT_MASK);
-        total_heap_size -= address - (size_t)pool;
-    }
+    puc_aligned_heap = (unsigned char *)pool;
+    heap->block_start.next_free_block = (void *)puc_aligned_heap;
+    heap->block_start.block_size = (size_t)0;
 
-    puc_aligned_heap = (unsigned char *)address;
-    heap_block_start.next_free_block = (void *)puc_aligned_heap;
-    heap_block_start.block_size = (size_t)0;
-
-    address = ((size_t)puc_aligned_heap) + total_heap_size;
+    address = ((size_t)puc_aligned_heap) + size;
     address -= HEAP_STRUCTURE_SIZE;
     address &= ~((size_t)HEAP_BYTE_ALIGNMENT_MASK);
-    heap_block_end = (struct heap_block_link *)address;
-    heap_block_end->block_size = 0;
-    heap_block_end->next_free_block = NULL;
+    heap->block_end = (struct heap_block_link *)address;
+    heap->block_end->block_size = 0;
+    heap->block_end->next_free_block = NULL;
 
     pfirst_free_block = (void *)puc_aligned_heap;
     pfirst_free_block->block_size = address - (size_t)pfirst_free_block;
-    pfirst_free_block->next_free_block = heap_block_end;
+    pfirst_free_block->next_free_block = heap->block_end;
 
-    heap_minimum_ever_free_bytes_remaining = pfirst_free_block->block_size;
-    heap_free_bytes_remaining = pfirst_free_block->block_size;
-    heap_block_allocated_bit = ((size_t)1) << ((sizeof(size_t) * HEAP_BITS_PER_BYTE) - 1);
+    heap->minimum_ever_free_bytes_remaining = pfirst_free_block->block_size;
+    heap->free_bytes_remaining = pfirst_free_block->block_size;
 }
 
 /* 向空闲列表插入空闲块 */
-static void static_insert_block_into_free_list(struct heap_block_link *block)
+static void static_insert_block_into_free_list(struct mem_heap *heap, struct heap_block_link *block)
 {
     struct heap_block_link *pit;
     unsigned char *puc;
 
-    for (pit = &heap_block_start; pit->next_free_block < block; pit = pit->next_free_block) {
+    for (pit = &heap->block_start; pit->next_free_block < block; pit = pit->next_free_block) {
         continue;
     }
 
@@ -86,11 +176,11 @@ static void static_insert_block_into_free_list(struct heap_block_link *block)
 
     puc = (unsigned char *)block;
     if ((puc + block->block_size) == (unsigned char *)pit->next_free_block) {
-        if (pit->next_free_block != heap_block_end) {
+        if (pit->next_free_block != heap->block_end) {
             block->block_size += pit->next_free_block->block_size;
             block->next_free_block = pit->next_free_block->next_free_block;
         } else {
-            block->next_free_block = heap_block_end;
+            block->next_free_block = heap->block_end;
         }
     } else {
         block->next_free_block = pit->next_free_block;
@@ -101,84 +191,734 @@ static void static_insert_block_into_free_list(struct heap_block_link *block)
     }
 }
 
-void *mem_alloc(size_t size)
+static inline unsigned int static_tlsf_fls(const size_t x)
 {
-    struct heap_block_link *pblock, *pprev_block, *pnew_block_link;
-    void *pret = NULL;
+    /* LLP64下long只有32位, 统一按unsigned long long计算 */
+    return sizeof(unsigned long long) * HEAP_BITS_PER_BYTE - 1 - __builtin_clzll((unsigned long long)x);
+}
 
-    /* */
-    // suspend all tasks
-    do {
-        if (heap_block_end == NULL)
-            static_heap_init(HEAP_ADDRESS, HEAP_AVAILABLE_SIZE);
+static inline size_t static_tlsf_size(const struct tlsf_block *block)
+{
+    return block->block_size & TLSF_BLOCK_SIZE_MASK;
+}
+
+static inline struct tlsf_block *static_tlsf_next_phys(const struct tlsf_block *block)
+{
+    return (struct tlsf_block *)(((unsigned char *)block) + static_tlsf_size(block));
+}
+
+static inline void static_tlsf_mapping(const size_t size, unsigned int *fl, unsigned int *sl)
+{
+    unsigned int t;
+
+    if (size < TLSF_SMALL_BLOCK_SIZE) {
+        *fl = 0;
+        *sl = size / (TLSF_SMALL_BLOCK_SIZE / TLSF_SL_COUNT);
+    } else {
+        t = static_tlsf_fls(size);
+        *sl = (size >> (t - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+        *fl = t - TLSF_FL_SHIFT + 1;
+    }
+}
+
+static void static_tlsf_insert(struct heap_tlsf *tlsf, struct tlsf_block *block)
+{
+    unsigned int fl, sl;
+    struct tlsf_block *head;
+
+    static_tlsf_mapping(static_tlsf_size(block), &fl, &sl);
+    head = tlsf->blocks[fl][sl];
+    block->prev_free_block = NULL;
+    block->next_free_block = head;
+    if (head != NULL) {
+        head->prev_free_block = block;
+    }
+
+    tlsf->blocks[fl][sl] = block;
+    tlsf->fl_bitmap |= (size_t)1 << fl;
+    tlsf->sl_bitmap[fl] |= 1U << sl;
+}
 
-        if ((size & heap_block_allocated_bit) == 0) {
-            if (size > 0) {
-                size += HEAP_STRUCTURE_SIZE;
+static void static_tlsf_remove(struct heap_tlsf *tlsf, struct tlsf_block *block)
+{
+    unsigned int fl, sl;
 
-                if ((size & HEAP_BYTE_ALIGNMENT_MASK) != 0x00)
-                    size += (HEAP_BYTE_ALIGNMENT - (size & HEAP_BYTE_ALIGNMENT_MASK));
+    static_tlsf_mapping(static_tlsf_size(block), &fl, &sl);
+    if (block->next_free_block != NULL) {
+        block->next_free_block->prev_free_block = block->prev_free_block;
+    }
+
+    if (block->prev_free_block != NULL) {
+        block->prev_free_block->next_free_block = block->next_free_block;
+    } else {
+        tlsf->blocks[fl][sl] = block->next_free_block;
+        if (tlsf->blocks[fl][sl] == NULL) {
+            tlsf->sl_bitmap[fl] &= ~(1U << sl);
+            if (tlsf->sl_bitmap[fl] == 0) {
+                tlsf->fl_bitmap &= ~((size_t)1 << fl);
             }
+        }
+    }
+}
 
-            if ((size > 0) && (size <= heap_free_bytes_remaining)) {
-                pprev_block = &heap_block_start;
-                pblock = heap_block_start.next_free_block;
-                while ((pblock->block_size < size) && (pblock->next_free_block != NULL)) {
-                    pprev_block = pblock;
-                    pblock = pblock->next_free_block;
-                }
+/*
+ * 找到一个不小于size的空闲块, 先把size向上取整到所在二级区间的上限, 保证链表中任何一块都够用, O(1);
+ * 找不到时再遍历size所在的链表, 只要堆中有够大的空闲块就不会失败, 这一步与链表长度成正比
+ */
+static struct tlsf_block *static_tlsf_search(struct heap_tlsf *tlsf, const size_t size)
+{
+    size_t fl_map;
+    size_t round;
+    unsigned int fl, sl, sl_map;
+    struct tlsf_block *block;
+
+    round = size;
+    if (size >= TLSF_SMALL_BLOCK_SIZE) {
+        round += ((size_t)1 << (static_tlsf_fls(size) - TLSF_SL_LOG2)) - 1;
+    }
 
-                if (pblock != heap_block_end) {
-                    pret = (void *)(((unsigned char *)pprev_block->next_free_block) + HEAP_STRUCTURE_SIZE);
-                    pprev_block->next_free_block = pblock->next_free_block;
+    static_tlsf_mapping(round, &fl, &sl);
+    if (fl < TLSF_FL_COUNT) {
+        sl_map = tlsf->sl_bitmap[fl] & (~0U << sl);
+        if (sl_map == 0) {
+            fl_map = (fl + 1 < TLSF_FL_COUNT) ? tlsf->fl_bitmap & (~(size_t)0 << (fl + 1)) : 0;
+            if (fl_map != 0) {
+                fl = __builtin_ctzll((unsigned long long)fl_map);
+                sl_map = tlsf->sl_bitmap[fl];
+            }
+        }
 
-                    if ((pblock->block_size - size) > HEAP_MINIMUM_BLOCK_SIZE) {
-                        pnew_block_link = (void *)(((unsigned char *)pblock) + size);
-                        pnew_block_link->block_size = pblock->block_size - size;
-                        pblock->block_size = size;
-                        static_insert_block_into_free_list(pnew_block_link);
-                    }
+        if (sl_map != 0) {
+            return tlsf->blocks[fl][__builtin_ctz(sl_map)];
+        }
+    }
 
-                    heap_free_bytes_remaining -= pblock->block_size;
-                    if (heap_free_bytes_remaining < heap_minimum_ever_free_bytes_remaining) {
-                        heap_minimum_ever_free_bytes_remaining = heap_free_bytes_remaining;
-                    }
+    static_tlsf_mapping(size, &fl, &sl);
+    if (fl >= TLSF_FL_COUNT) {
+        return NULL;
+    }
 
-                    pblock->block_size |= heap_block_allocated_bit;
-                    pblock->next_free_block = NULL;
-                }
+    for (block = tlsf->blocks[fl][sl]; block != NULL; block = block->next_free_block) {
+        if (static_tlsf_size(block) >= size) {
+            return block;
+        }
+    }
+
+    return NULL;
+}
+
+/* 整个区域是一个空闲块加一个大小为0的已分配结尾块, 结尾块保证合并时不会越界 */
+static void static_tlsf_init(struct mem_heap *heap, void *pool, const size_t size)
+{
+    size_t address;
+    struct tlsf_block *block, *end;
+
+    address = ((size_t)pool + size - HEAP_STRUCTURE_SIZE) & ~((size_t)HEAP_BYTE_ALIGNMENT_MASK);
+    block = (struct tlsf_block *)pool;
+    block->prev_phys_block = NULL;
+    block->block_size = (address - (size_t)pool) | TLSF_BLOCK_FREE;
+
+    end = (struct tlsf_block *)address;
+    end->prev_phys_block = block;
+    end->block_size = 0;
+
+    static_tlsf_insert(heap->tlsf, block);
+    heap->minimum_ever_free_bytes_remaining = static_tlsf_size(block);
+    heap->free_bytes_remaining = static_tlsf_size(block);
+}
+
+static void *static_tlsf_alloc(struct mem_heap *heap, size_t size)
+{
+    struct tlsf_block *block, *remain;
+
+    size += HEAP_STRUCTURE_SIZE;
+    if ((size & HEAP_BYTE_ALIGNMENT_MASK) != 0x00)
+        size += (HEAP_BYTE_ALIGNMENT - (size & HEAP_BYTE_ALIGNMENT_MASK));
+    if (size < TLSF_MINIMUM_BLOCK_SIZE)
+        size = TLSF_MINIMUM_BLOCK_SIZE;
+
+    if (size > heap->free_bytes_remaining) {
+        return NULL;
+    }
+
+    block = static_tlsf_search(heap->tlsf, size);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    static_tlsf_remove(heap->tlsf, block);
+    if (static_tlsf_size(block) - size >= TLSF_MINIMUM_BLOCK_SIZE) {
+        remain = (struct tlsf_block *)(((unsigned char *)block) + size);
+        remain->prev_phys_block = block;
+        remain->block_size = (static_tlsf_size(block) - size) | TLSF_BLOCK_FREE;
+        static_tlsf_next_phys(remain)->prev_phys_block = remain;
+        static_tlsf_insert(heap->tlsf, remain);
+        block->block_size = size;
+    } else {
+        block->block_size &= ~TLSF_BLOCK_FREE;
+    }
+
+    heap->free_bytes_remaining -= static_tlsf_size(block);
+    if (heap->free_bytes_remaining < heap->minimum_ever_free_bytes_remaining) {
+        heap->minimum_ever_free_bytes_remaining = heap->free_bytes_remaining;
+    }
+
+    return ((unsigned char *)block) + HEAP_STRUCTURE_SIZE;
+}
+
+/* 与物理上相邻的空闲块立即合并 */
+static void static_tlsf_free(struct mem_heap *heap, struct tlsf_block *block)
+{
+    struct tlsf_block *prev, *next;
+
+    heap->free_bytes_remaining += static_tlsf_size(block);
+    prev = block->prev_phys_block;
+    if ((prev != NULL) && ((prev->block_size & TLSF_BLOCK_FREE) != 0)) {
+        static_tlsf_remove(heap->tlsf, prev);
+        prev->block_size += static_tlsf_size(block);
+        block = prev;
+    }
+
+    next = static_tlsf_next_phys(block);
+    if ((next->block_size & TLSF_BLOCK_FREE) != 0) {
+        static_tlsf_remove(heap->tlsf, next);
+        block->block_size += static_tlsf_size(next);
+    }
+
+    block->block_size |= TLSF_BLOCK_FREE;
+    static_tlsf_next_phys(block)->prev_phys_block = block;
+    static_tlsf_insert(heap->tlsf, block);
+}
+
+mem_heap_t *mem_heap_create(void *pool, size_t size, unsigned int flags)
+{
+    size_t address;
+    size_t control;
+    struct mem_heap *heap;
+
+    if (pool == NULL) {
+        return NULL;
+    }
+
+#if !defined (__linux__)
+    /* 没有锁的实现, 不能返回一个调用者以为线程安全的堆 */
+    if (flags & (MEM_HEAP_F_MUTEX | MEM_HEAP_F_SPIN)) {
+        return NULL;
+    }
+#endif
+
+    address = (size_t)pool;
+    if ((address & HEAP_BYTE_ALIGNMENT_MASK) != 0) {
+        address += HEAP_BYTE_ALIGNMENT - 1;
+        address &= ~((size_t)HEAP_BYTE_ALIGNMENT_MASK);
+        if (size < address - (size_t)pool) {
+            return NULL;
+        }
+        size -= address - (size_t)pool;
+    }
+
+    /* 控制结构之后至少要能放下一个最小块和结尾块 */
+    control = HEAP_CONTROL_SIZE + ((flags & MEM_HEAP_F_TLSF) ? HEAP_TLSF_SIZE : 0);
+    if (size < control + HEAP_MINIMUM_BLOCK_SIZE + HEAP_STRUCTURE_SIZE) {
+        return NULL;
+    }
+
+    heap = (struct mem_heap *)address;
+    memset(heap, 0, sizeof(struct mem_heap));
+    heap->flags = flags;
+#if defined (__linux__)
+    if (flags & MEM_HEAP_F_SPIN) {
+        if (pthread_spin_init(&heap->lock.spin, PTHREAD_PROCESS_PRIVATE) != 0) {
+            return NULL;
+        }
+    } else if (flags & MEM_HEAP_F_MUTEX) {
+        if (pthread_mutex_init(&heap->lock.mutex, NULL) != 0) {
+            return NULL;
+        }
+    }
+#endif
+
+    if (flags & MEM_HEAP_F_TLSF) {
+        heap->tlsf = (struct heap_tlsf *)(address + HEAP_CONTROL_SIZE);
+        memset(heap->tlsf, 0, sizeof(struct heap_tlsf));
+        static_tlsf_init(heap, (void *)(address + control), size - control);
+    } else {
+        static_heap_init(heap, (void *)(address + control), size - control);
+    }
+
+    return heap;
+}
+
+void mem_heap_destroy(mem_heap_t *heap)
+{
+    if (heap == NULL) {
+        return;
+    }
+
+#if defined (__linux__)
+    if (heap->flags & MEM_HEAP_F_SPIN) {
+        pthread_spin_destroy(&heap->lock.spin);
+    } else if (heap->flags & MEM_HEAP_F_MUTEX) {
+        pthread_mutex_destroy(&heap->lock.mutex);
+    }
+#endif
+}
+
+/* 按地址排序的空闲链表, 首次适配 */
+static void *static_list_alloc(struct mem_heap *heap, size_t size)
+{
+    struct heap_block_link *pblock, *pprev_block, *pnew_block_link;
+    void *pret = NULL;
+
+    size += HEAP_STRUCTURE_SIZE;
+    if ((size & HEAP_BYTE_ALIGNMENT_MASK) != 0x00)
+        size += (HEAP_BYTE_ALIGNMENT - (size & HEAP_BYTE_ALIGNMENT_MASK));
+
+    if (size <= heap->free_bytes_remaining) {
+        pprev_block = &heap->block_start;
+        pblock = heap->block_start.next_free_block;
+        while ((pblock->block_size < size) && (pblock->next_free_block != NULL)) {
+            pprev_block = pblock;
+            pblock = pblock->next_free_block;
+        }
+
+        if (pblock != heap->block_end) {
+            pret = (void *)(((unsigned char *)pprev_block->next_free_block) + HEAP_STRUCTURE_SIZE);
+            pprev_block->next_free_block = pblock->next_free_block;
+
+            if ((pblock->block_size - size) > HEAP_MINIMUM_BLOCK_SIZE) {
+                pnew_block_link = (void *)(((unsigned char *)pblock) + size);
+                pnew_block_link->block_size = pblock->block_size - size;
+                pblock->block_size = size;
+                static_insert_block_into_free_list(heap, pnew_block_link);
+            }
+
+            heap->free_bytes_remaining -= pblock->block_size;
+            if (heap->free_bytes_remaining < heap->minimum_ever_free_bytes_remaining) {
+                heap->minimum_ever_free_bytes_remaining = heap->free_bytes_remaining;
             }
+
+            pblock->block_size |= HEAP_BLOCK_ALLOCATED_BIT;
+            pblock->next_free_block = NULL;
         }
-    } while (0);
-    // resume all tasks
+    }
 
     return pret;
 }
 
-void mem_free(void *pv)
+void *mem_heap_alloc(mem_heap_t *heap, size_t size)
+{
+    void *pret;
+    uint64_t start = 0;
+
+    if ((heap == NULL) || (size == 0) || ((size & HEAP_BLOCK_ALLOCATED_BIT) != 0)) {
+        return NULL;
+    }
+
+    if (heap->flags & MEM_HEAP_F_TIMING)
+        start = static_heap_cycles();
+
+    static_heap_lock(heap);
+    if (heap->tlsf != NULL) {
+        pret = static_tlsf_alloc(heap, size);
+    } else {
+        pret = static_list_alloc(heap, size);
+    }
+
+    if (heap->flags & MEM_HEAP_F_TIMING)
+        static_heap_account(&heap->alloc_calls, &heap->alloc_cycles, &heap->alloc_cycles_max, start);
+    static_heap_unlock(heap);
+
+    return pret;
+}
+
+void mem_heap_free(mem_heap_t *heap, void *pv)
 {
     unsigned char *puc = (unsigned char *)pv;
     struct heap_block_link *plink;
+    struct tlsf_block *pblock;
+    uint64_t start = 0;
 
-    if (pv != NULL) {
+    if ((heap != NULL) && (pv != NULL)) {
         puc -= HEAP_STRUCTURE_SIZE;
         plink = (void *)puc;
+        pblock = (void *)puc;
+
+        if (heap->tlsf != NULL) {
+            if ((pblock->block_size & TLSF_BLOCK_FREE) != 0) {
+                return;
+            }
+        } else if (((plink->block_size & HEAP_BLOCK_ALLOCATED_BIT) == 0) || (plink->next_free_block != NULL)) {
+            return;
+        }
+
+        if (heap->flags & MEM_HEAP_F_TIMING)
+            start = static_heap_cycles();
+
+        static_heap_lock(heap);
+        if (heap->tlsf != NULL) {
+            static_tlsf_free(heap, pblock);
+        } else {
+            plink->block_size &= ~HEAP_BLOCK_ALLOCATED_BIT;
+            heap->free_bytes_remaining += plink->block_size;
+            static_insert_block_into_free_list(heap, plink);
+        }
+
+        if (heap->flags & MEM_HEAP_F_TIMING)
+            static_heap_account(&heap->free_calls, &heap->free_cycles, &heap->free_cycles_max, start);
+        static_heap_unlock(heap);
+    }
+}
+
+/* 申请和调整大小时块的总大小, 包括块头 */
+static inline size_t static_heap_block_size(const struct mem_heap *heap, size_t size)
+{
+    size += HEAP_STRUCTURE_SIZE;
+    if ((size & HEAP_BYTE_ALIGNMENT_MASK) != 0x00)
+        size += (HEAP_BYTE_ALIGNMENT - (size & HEAP_BYTE_ALIGNMENT_MASK));
+    if ((heap->tlsf != NULL) && (size < TLSF_MINIMUM_BLOCK_SIZE))
+        size = TLSF_MINIMUM_BLOCK_SIZE;
+
+    return size;
+}
+
+/* 已分配块的总大小 */
+static inline size_t static_heap_used_size(const struct mem_heap *heap, const void *pv)
+{
+    const unsigned char *puc = (const unsigned char *)pv - HEAP_STRUCTURE_SIZE;
+
+    if (heap->tlsf != NULL)
+        return static_tlsf_size((const struct tlsf_block *)puc);
+
+    return ((const struct heap_block_link *)puc)->block_size & ~HEAP_BLOCK_ALLOCATED_BIT;
+}
+
+/* 已分配块超过size的尾部拆成空闲块, 需要持有锁 */
+static void static_heap_split_tail(struct mem_heap *heap, void *pv, const size_t size)
+{
+    size_t used;
+    unsigned char *puc = (unsigned char *)pv - HEAP_STRUCTURE_SIZE;
+    struct heap_block_link *plink, *ptail;
+    struct tlsf_block *pblock, *premain;
+
+    used = static_heap_used_size(heap, pv);
+    if (heap->tlsf != NULL) {
+        if (used - size < TLSF_MINIMUM_BLOCK_SIZE)
+            return;
+
+        pblock = (struct tlsf_block *)puc;
+        premain = (struct tlsf_block *)(puc + size);
+        premain->prev_phys_block = pblock;
+        premain->block_size = used - size;
+        static_tlsf_next_phys(premain)->prev_phys_block = premain;
+        pblock->block_size = size;
+        static_tlsf_free(heap, premain);
+    } else {
+        if (used - size <= HEAP_MINIMUM_BLOCK_SIZE)
+            return;
+
+        plink = (struct heap_block_link *)puc;
+        ptail = (struct heap_block_link *)(puc + size);
+        ptail->block_size = used - size;
+        plink->block_size = size | HEAP_BLOCK_ALLOCATED_BIT;
+        heap->free_bytes_remaining += ptail->block_size;
+        static_insert_block_into_free_list(heap, ptail);
+    }
+}
+
+/* 已分配块的头部lead字节拆成空闲块, 返回剩下部分的数据区, 需要持有锁 */
+static void *static_heap_split_head(struct mem_heap *heap, void *pv, const size_t lead)
+{
+    size_t used;
+    unsigned char *puc = (unsigned char *)pv - HEAP_STRUCTURE_SIZE;
+    struct heap_block_link *plink, *pnew_link;
+    struct tlsf_block *pblock, *pnew_block;
+
+    used = static_heap_used_size(heap, pv);
+    if (heap->tlsf != NULL) {
+        pblock = (struct tlsf_block *)puc;
+        pnew_block = (struct tlsf_block *)(puc + lead);
+        pnew_block->prev_phys_block = pblock;
+        pnew_block->block_size = used - lead;
+        static_tlsf_next_phys(pnew_block)->prev_phys_block = pnew_block;
+        pblock->block_size = lead;
+        static_tlsf_free(heap, pblock);
+    } else {
+        plink = (struct heap_block_link *)puc;
+        pnew_link = (struct heap_block_link *)(puc + lead);
+        pnew_link->block_size = (used - lead) | HEAP_BLOCK_ALLOCATED_BIT;
+        pnew_link->next_free_block = NULL;
+        plink->block_size = lead;
+        heap->free_bytes_remaining += lead;
+        static_insert_block_into_free_list(heap, plink);
+    }
+
+    return puc + lead + HEAP_STRUCTURE_SIZE;
+}
+
+/*
+ * 物理上紧跟的空闲块足够时并入当前块, 需要持有锁;
+ * 先整块并入再还回尾部, 剩余空间的历史最低值只按最后真正占用的部分计算
+ */
+static bool static_heap_grow(struct mem_heap *heap, void *pv, const size_t size)
+{
+    size_t used;
+    size_t minimum;
+    unsigned char *puc = (unsigned char *)pv - HEAP_STRUCTURE_SIZE;
+    struct heap_block_link *plink, *pit, *pnext_link;
+    struct tlsf_block *pblock, *pnext;
+
+    used = static_heap_used_size(heap, pv);
+    minimum = heap->minimum_ever_free_bytes_remaining;
+    if (heap->tlsf != NULL) {
+        pblock = (struct tlsf_block *)puc;
+        pnext = static_tlsf_next_phys(pblock);
+        if (((pnext->block_size & TLSF_BLOCK_FREE) == 0) || (used + static_tlsf_size(pnext) < size))
+            return false;
+
+        static_tlsf_remove(heap->tlsf, pnext);
+        heap->free_bytes_remaining -= static_tlsf_size(pnext);
+        pblock->block_size += static_tlsf_size(pnext);
+        static_tlsf_next_phys(pblock)->prev_phys_block = pblock;
+    } else {
+        plink = (struct heap_block_link *)puc;
+        pnext_link = (struct heap_block_link *)(puc + used);
+        for (pit = &heap->block_start; pit->next_free_block < pnext_link; pit = pit->next_free_block) {
+            continue;
+        }
+
+        if ((pit->next_free_block != pnext_link) || (pnext_link == heap->block_end)
+                || (used + pnext_link->block_size < size))
+            return false;
+
+        pit->next_free_block = pnext_link->next_free_block;
+        heap->free_bytes_remaining -= pnext_link->block_size;
+        plink->block_size += pnext_link->block_size;
+    }
+
+    static_heap_split_tail(heap, pv, size);
+    if (heap->free_bytes_remaining < minimum) {
+        minimum = heap->free_bytes_remaining;
+    }
+    heap->minimum_ever_free_bytes_remaining = minimum;
+
+    return true;
+}
+
+/*
+ * 多申请align加一个最小块的空间, 对齐位置之前的部分作为空闲块还回去, 多出的尾部也还回去;
+ * 多申请的部分不计入剩余空间的历史最低值
+ */
+void *mem_heap_alloc_aligned(mem_heap_t *heap, size_t size, size_t align)
+{
+    void *pret;
+    size_t lead;
+    size_t extra;
+    size_t minimum;
+
+    if ((align & (align - 1)) != 0) {
+        return NULL;
+    }
+
+    if (align <= HEAP_BYTE_ALIGNMENT) {
+        return mem_heap_alloc(heap, size);
+    }
+
+    if ((heap == NULL) || (size == 0) || ((size & HEAP_BLOCK_ALLOCATED_BIT) != 0)) {
+        return NULL;
+    }
+
+    size = static_heap_block_size(heap, size) - HEAP_STRUCTURE_SIZE;
+    extra = align + ((heap->tlsf != NULL) ? TLSF_MINIMUM_BLOCK_SIZE : HEAP_MINIMUM_BLOCK_SIZE + HEAP_BYTE_ALIGNMENT);
+    static_heap_lock(heap);
+    minimum = heap->minimum_ever_free_bytes_remaining;
+    if (heap->tlsf != NULL) {
+        pret = static_tlsf_alloc(heap, size + extra);
+    } else {
+        pret = static_list_alloc(heap, size + extra);
+    }
+
+    if (pret != NULL) {
+        lead = (align - ((size_t)pret & (align - 1))) & (align - 1);
+        /* 头部太小放不下一个空闲块时跳到下一个对齐位置 */
+        while ((lead != 0) && (lead < extra - align)) {
+            lead += align;
+        }
+
+        if (lead != 0) {
+            pret = static_heap_split_head(heap, pret, lead);
+        }
+
+        static_heap_split_tail(heap, pret, static_heap_block_size(heap, size));
+        if (heap->free_bytes_remaining < minimum) {
+            minimum = heap->free_bytes_remaining;
+        }
+        heap->minimum_ever_free_bytes_remaining = minimum;
+    }
+    static_heap_unlock(heap);
 
-        if ((plink->block_size & heap_block_allocated_bit) != 0) {
-            if (plink->next_free_block == NULL) {
-                plink->block_size &= ~heap_block_allocated_bit;
-                // suspend all tasks
-                heap_free_bytes_remaining += plink->block_size;
-                static_insert_block_into_free_list(plink);
-                // resume all tasks
+    return pret;
+}
+
+void *mem_heap_realloc(mem_heap_t *heap, void *pv, size_t size)
+{
+    void *pret;
+    size_t used;
+    size_t needed;
+    bool in_place;
+
+    if (pv == NULL) {
+        return mem_heap_alloc(heap, size);
+    }
+
+    if (size == 0) {
+        mem_heap_free(heap, pv);
+        return NULL;
+    }
+
+    if ((heap == NULL) || ((size & HEAP_BLOCK_ALLOCATED_BIT) != 0)) {
+        return NULL;
+    }
+
+    static_heap_lock(heap);
+    needed = static_heap_block_size(heap, size);
+    used = static_heap_used_size(heap, pv);
+    if (needed <= used) {
+        static_heap_split_tail(heap, pv, needed);
+        in_place = true;
+    } else {
+        in_place = static_heap_grow(heap, pv, needed);
+    }
+    static_heap_unlock(heap);
+
+    if (in_place) {
+        return pv;
+    }
+
+    pret = mem_heap_alloc(heap, size);
+    if (pret != NULL) {
+        memcpy(pret, pv, used - HEAP_STRUCTURE_SIZE);
+        mem_heap_free(heap, pv);
+    }
+
+    return pret;
+}
+
+size_t mem_heap_avaiable_size(mem_heap_t *heap)
+{
+    return heap != NULL ? heap->free_bytes_remaining : 0;
+}
+
+/* TLSF的查找在取整失败后会遍历所在的链表, 所以最大空闲块在两种模式下都一定能申请到 */
+static void static_heap_count_free_block(mem_heap_stats_t *stats, const size_t block_size)
+{
+    stats->free_blocks++;
+    if (block_size - HEAP_STRUCTURE_SIZE > stats->largest_free_block) {
+        stats->largest_free_block = block_size - HEAP_STRUCTURE_SIZE;
+    }
+}
+
+void mem_heap_stats(mem_heap_t *heap, mem_heap_stats_t *stats)
+{
+    unsigned int fl, sl;
+    struct tlsf_block *pblock;
+    struct heap_block_link *plink;
+
+    if (stats == NULL) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    if (heap == NULL) {
+        return;
+    }
+
+    static_heap_lock(heap);
+    if (heap->tlsf != NULL) {
+        for (fl = 0; fl < TLSF_FL_COUNT; fl++) {
+            for (sl = 0; sl < TLSF_SL_COUNT; sl++) {
+                for (pblock = heap->tlsf->blocks[fl][sl]; pblock != NULL; pblock = pblock->next_free_block) {
+                    static_heap_count_free_block(stats, static_tlsf_size(pblock));
+                }
             }
         }
+    } else {
+        for (plink = heap->block_start.next_free_block; plink != heap->block_end; plink = plink->next_free_block) {
+            static_heap_count_free_block(stats, plink->block_size);
+        }
+    }
+
+    stats->free_bytes = heap->free_bytes_remaining;
+    stats->minimum_ever_free_bytes = heap->minimum_ever_free_bytes_remaining;
+    stats->alloc_calls = heap->alloc_calls;
+    stats->alloc_cycles = heap->alloc_cycles;
+    stats->alloc_cycles_max = heap->alloc_cycles_max;
+    stats->free_calls = heap->free_calls;
+    stats->free_cycles = heap->free_cycles;
+    stats->free_cycles_max = heap->free_cycles_max;
+    static_heap_unlock(heap);
+
+    /* free_bytes按整块计算, 包含块头 */
+    if (stats->free_blocks != 0) {
+        stats->fragmentation = 1000 - (unsigned int)((uint64_t)(stats->largest_free_block + HEAP_STRUCTURE_SIZE)
+            * 1000 / stats->free_bytes);
     }
 }
 
+#endif
+
+#if (!defined (_WIN32) && !defined (__linux__)) || (defined (ENABLE_MEMORY_POOL) && (ENABLE_MEMORY_POOL != 0U))
+
+/**内存池的地址和大小**/
+#if !defined (HEAP_AVAILABLE_SIZE)
+#define HEAP_AVAILABLE_SIZE         0x000800000 /* 8M Bytes */
+#endif
+
+#if !defined (HEAP_ADDRESS)
+static char port_memory_address[HEAP_AVAILABLE_SIZE];
+#define HEAP_ADDRESS                ((void *)port_memory_address)
+#endif
+
+/* 默认的堆不加锁, 与原来一样由调用者挂起其他任务 */
+static mem_heap_t *heap_default = NULL;
+
+void *mem_alloc(size_t size)
+{
+    if (heap_default == NULL)
+        heap_default = mem_heap_create(HEAP_ADDRESS, HEAP_AVAILABLE_SIZE, 0);
+
+    return mem_heap_alloc(heap_default, size);
+}
+
+void mem_free(void *pv)
+{
+    mem_heap_free(heap_default, pv);
+}
+
 size_t mem_avaiable_size(void)
 {
-    return heap_free_bytes_remaining;
+    return mem_heap_avaiable_size(heap_default);
+}
+
+void mem_stats(mem_heap_stats_t *stats)
+{
+    mem_heap_stats(heap_default, stats);
+}
+
+void *mem_alloc_aligned(size_t size, size_t align)
+{
+    if (heap_default == NULL)
+        heap_default = mem_heap_create(HEAP_ADDRESS, HEAP_AVAILABLE_SIZE, 0);
+
+    return mem_heap_alloc_aligned(heap_default, size, align);
+}
+
+void *mem_realloc(void *pv, size_t size)
+{
+    if (heap_default == NULL)
+        heap_default = mem_heap_create(HEAP_ADDRESS, HEAP_AVAILABLE_SIZE, 0);
+
+    return mem_heap_realloc(heap_default, pv, size);
 }
 
 #endif
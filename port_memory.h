@@ -1,45 +1,161 @@
 ﻿#pragma once
 
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* 堆的统计信息, 周期数只在MEM_HEAP_F_TIMING时统计, 包含等锁的时间 */
+typedef struct mem_heap_stats {
+    size_t free_bytes;                  /* 剩余空间 */
+    size_t minimum_ever_free_bytes;     /* 剩余空间的历史最低值 */
+    size_t free_blocks;                 /* 空闲块个数 */
+    size_t largest_free_block;          /* 最大空闲块的数据区字节数, 两种模式下都能一次申请到 */
+    unsigned int fragmentation;         /* 碎片率, 千分比: 1000 * (1 - 最大空闲块(含块头) / 剩余空间) */
+    uint64_t alloc_calls;
+    uint64_t alloc_cycles;              /* 累计周期数 */
+    uint64_t alloc_cycles_max;          /* 单次最大周期数 */
+    uint64_t free_calls;
+    uint64_t free_cycles;
+    uint64_t free_cycles_max;
+} mem_heap_stats_t;
+
+#if !defined (_WIN32) || (defined (ENABLE_MEMORY_POOL) && (ENABLE_MEMORY_POOL != 0U))
+
+typedef struct mem_heap mem_heap_t;
+
+/* 堆的互斥方式, 都不设置时由调用者保证同一时刻只有一个线程访问; 非linux平台设置时mem_heap_create返回NULL */
+#define MEM_HEAP_F_MUTEX    0x01U   /* pthread_mutex, 仅linux */
+#define MEM_HEAP_F_SPIN     0x02U   /* pthread_spinlock, 仅linux, 临界区很短适合实时线程 */
+/* 两级分离适配(TLSF), 申请和释放都是O(1), 最坏延迟有界, 控制结构多占用约7K */
+#define MEM_HEAP_F_TLSF     0x04U
+/* 统计每次mem_heap_alloc/mem_heap_free的周期数(x86为TSC, aarch64为通用定时器) */
+#define MEM_HEAP_F_TIMING   0x08U
+
+/* 在调用者提供的内存上建立一个独立的堆, 控制结构也放在这片内存的开头, 太小时返回NULL */
+extern mem_heap_t *mem_heap_create(void *pool, size_t size, unsigned int flags);
+
+/* 销毁锁, 内存由调用者自己回收 */
+extern void mem_heap_destroy(mem_heap_t *heap);
+
+/* 从指定的堆中申请出一片内存 */
+extern void *mem_heap_alloc(mem_heap_t *heap, size_t size);
+
+/* 按align字节对齐申请, align必须是2的幂, 用mem_heap_free释放 */
+extern void *mem_heap_alloc_aligned(mem_heap_t *heap, size_t size, size_t align);
+
+/* 释放到申请时的堆中 */
+extern void mem_heap_free(mem_heap_t *heap, void *pv);
+
+/* 优先原地缩小或并入后面相邻的空闲块, 都不行才申请新块并拷贝, 失败时原内存不变 */
+extern void *mem_heap_realloc(mem_heap_t *heap, void *pv, size_t size);
+
+/* 获取堆的剩余空间 */
+extern size_t mem_heap_avaiable_size(mem_heap_t *heap);
+
+/* 遍历空闲块统计碎片情况, 持锁时间与空闲块个数成正比 */
+extern void mem_heap_stats(mem_heap_t *heap, mem_heap_stats_t *stats);
+
+#endif
+
 #if (!defined (_WIN32) && !defined (__linux__)) || (defined (ENABLE_MEMORY_POOL) && (ENABLE_MEMORY_POOL != 0U))
 
 /* 从内存池中申请出一片内存 */
 extern void *mem_alloc(size_t size);
 
+/* 从内存池中按align字节对齐申请, align必须是2的幂 */
+extern void *mem_alloc_aligned(size_t size, size_t align);
+
 /* 释放内存池中的内存 */
 extern void mem_free(void *pv);
 
+/* 调整大小, 优先原地扩展 */
+extern void *mem_realloc(void *pv, size_t size);
+
 /* 获取内存池剩余空间 */
 extern size_t mem_avaiable_size(void);
 
+/* 获取内存池的统计信息 */
+extern void mem_stats(mem_heap_stats_t *stats);
+
 #else
 
 #include <stdlib.h>
+#include <string.h>
+#if defined (_WIN32)
+#include <malloc.h>
+
+/*
+ * windows上对齐的内存只能用_aligned_free释放, 所以这里全部走_aligned_*系列,
+ * mem_alloc按malloc本身的对齐申请; mem_realloc也按这个对齐, 不能用于mem_alloc_aligned得到的内存
+ */
+#define MEM_DEFAULT_ALIGNMENT   (2 * sizeof(void *))
+#endif
 
 /* 从内存池中申请出一片内存 */
 static inline void *mem_alloc(size_t size)
 {
+#if defined (_WIN32)
+    return _aligned_malloc(size, MEM_DEFAULT_ALIGNMENT);
+#else
     return malloc(size);
+#endif
+}
+
+/* 从内存池中按align字节对齐申请, align必须是2的幂 */
+static inline void *mem_alloc_aligned(size_t size, size_t align)
+{
+#if defined (_WIN32)
+    return _aligned_malloc(size, align < MEM_DEFAULT_ALIGNMENT ? MEM_DEFAULT_ALIGNMENT : align);
+#else
+    void *pv;
+
+    if (align < sizeof(void *)) {
+        align = sizeof(void *);
+    }
+
+    return posix_memalign(&pv, align, size) == 0 ? pv : NULL;
+#endif
 }
 
 /* 释放内存池中的内存 */
 static inline void mem_free(void *pv)
 {
     if (pv != NULL) {
+#if defined (_WIN32)
+        _aligned_free(pv);
+#else
         free(pv);
+#endif
     }
 }
 
+/* 调整大小, 优先原地扩展 */
+static inline void *mem_realloc(void *pv, size_t size)
+{
+#if defined (_WIN32)
+    return _aligned_realloc(pv, size, MEM_DEFAULT_ALIGNMENT);
+#else
+    return realloc(pv, size);
+#endif
+}
+
 /* 获取内存池剩余空间 */
 static inline size_t mem_avaiable_size(void)
 {
     return 0;
 }
 
+/* 获取内存池的统计信息 */
+static inline void mem_stats(mem_heap_stats_t *stats)
+{
+    if (stats != NULL) {
+        memset(stats, 0, sizeof(*stats));
+    }
+}
+
 #endif
 
 #ifdef __cplusplus
@@ -1,5 +1,18 @@
 ﻿#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#if defined (__linux__)
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 #include <queue.h>
 #include <port_memory.h>
@@ -21,10 +34,26 @@ struct circular_queue *circular_queue_create(const unsigned int size, const unsi
     q->used_size = 0;
     q->front = 0;
     q->rear = 0;
+    q->mask = (size & (size - 1)) == 0 ? size - 1 : 0;
+    q->reserved = 0;
+    q->peeked = 0;
 
     return q;
 }
 
+/* 指针前进n个数据块(n不超过size), size为2的幂时用掩码代替取模 */
+static inline unsigned int circular_queue_advance(const struct circular_queue *q, const unsigned int pos,
+    const unsigned int n)
+{
+    unsigned int next;
+
+    if (q->mask != 0)
+        return (pos + n) & q->mask;
+
+    next = pos + n;
+    return next >= q->size ? next - q->size : next;
+}
+
 int circular_queue_full(const struct circular_queue *q)
 {
     if (q == NULL)
@@ -57,47 +86,148 @@ unsigned int circular_queue_avaiable_size(const struct circular_queue *q)
     return q->size - q->used_size;
 }
 
+/* 一次算出可以拷贝的块数, 以尾部为界最多分两段memcpy */
 unsigned int circular_queue_enque(struct circular_queue *q, const void *data, const unsigned int size)
 {
-    unsigned int i;
+    unsigned int n, first;
 
     if (q == NULL || data == NULL)
         return 0;
 
-    for (i = 0; i < size; ++i) {
-        if (circular_queue_full(q))
-            break;
+    n = q->size - q->used_size;
+    if (n > size)
+        n = size;
+    if (n == 0)
+        return 0;
 
-        memcpy(q->data + q->rear * q->block_size, data, q->block_size);
-        data = (const char *)data + q->block_size;
-        q->rear = (q->rear + 1) % q->size;
-        ++q->used_size;
-    }
+    first = q->size - q->rear;
+    if (first > n)
+        first = n;
+
+    memcpy(q->data + (size_t)q->rear * q->block_size, data, (size_t)first * q->block_size);
+    if (n > first)
+        memcpy(q->data, (const char *)data + (size_t)first * q->block_size, (size_t)(n - first) * q->block_size);
 
-    return i;
+    q->rear = circular_queue_advance(q, q->rear, n);
+    q->used_size += n;
+    q->reserved = 0;
+
+    return n;
 }
 
 unsigned int circular_queue_deque(struct circular_queue *q, void *data, const unsigned int size)
 {
-    unsigned int i;
+    unsigned int n, first;
 
     if (q == NULL)
         return 0;
 
-    for (i = 0; i < size; ++i) {
-        if (circular_queue_empty(q))
-            break;
+    n = q->used_size;
+    if (n > size)
+        n = size;
+    if (n == 0)
+        return 0;
 
-        if (data != NULL) {
-            memcpy(data, q->data + q->front * q->block_size, q->block_size);
-            data = (char *)data + q->block_size;
-        }
+    if (data != NULL) {
+        first = q->size - q->front;
+        if (first > n)
+            first = n;
 
-        q->front = (q->front + 1) % q->size;
-        --q->used_size;
+        memcpy(data, q->data + (size_t)q->front * q->block_size, (size_t)first * q->block_size);
+        if (n > first)
+            memcpy((char *)data + (size_t)first * q->block_size, q->data, (size_t)(n - first) * q->block_size);
     }
 
-    return i;
+    q->front = circular_queue_advance(q, q->front, n);
+    q->used_size -= n;
+    q->peeked = 0;
+
+    return n;
+}
+
+void *circular_queue_reserve(struct circular_queue *q, const unsigned int size, unsigned int *count)
+{
+    unsigned int n;
+
+    if (count != NULL)
+        *count = 0;
+    if (q == NULL)
+        return NULL;
+
+    n = q->size - q->used_size;
+    if (n > q->size - q->rear)
+        n = q->size - q->rear;
+    if (n > size)
+        n = size;
+    q->reserved = n;
+    if (n == 0)
+        return NULL;
+
+    if (count != NULL)
+        *count = n;
+
+    return q->data + (size_t)q->rear * q->block_size;
+}
+
+/* 数据已由调用者写在rear处, 只需移动尾指针, 不能越过reserve给出的连续区域 */
+unsigned int circular_queue_commit(struct circular_queue *q, const unsigned int size)
+{
+    unsigned int n;
+
+    if (q == NULL)
+        return 0;
+
+    n = q->reserved;
+    if (n > size)
+        n = size;
+
+    q->rear = circular_queue_advance(q, q->rear, n);
+    q->used_size += n;
+    q->reserved -= n;
+
+    return n;
+}
+
+const void *circular_queue_peek(struct circular_queue *q, const unsigned int size, unsigned int *count)
+{
+    unsigned int n;
+
+    if (count != NULL)
+        *count = 0;
+    if (q == NULL)
+        return NULL;
+
+    n = q->used_size;
+    if (n > q->size - q->front)
+        n = q->size - q->front;
+    if (n > size)
+        n = size;
+    q->peeked = n;
+    if (n == 0)
+        return NULL;
+
+    if (count != NULL)
+        *count = n;
+
+    return q->data + (size_t)q->front * q->block_size;
+}
+
+unsigned int circular_queue_release(struct circular_queue *q, const unsigned int size)
+{
+    unsigned int n;
+
+    if (q == NULL)
+        return 0;
+
+    n = q->peeked;
+    if (n > size)
+        n = size;
+
+    q->front = circular_queue_advance(q, q->front, n);
+    q->used_size -= n;
+    q->peeked -= n;
+
+    return n;
 }
 
 int circular_queue_front(const struct circular_queue *q, void *data, const unsigned int size)
@@ -116,7 +246,7 @@ int circular_queue_front(const struct circular_queue *q, void *data, const unsig
 
         memcpy(data, q->data +j * q->block_size, q->block_size);
         data = (char *)data + q->block_size;
-        j = (j + 1) % q->size;
+        j = circular_queue_advance(q, j, 1);
     }
 
     return 1;
@@ -146,9 +276,712 @@ void circular_queue_clear(struct circular_queue *q)
     q->used_size = 0;
     q->front = 0;
     q->rear = 0;
+    q->reserved = 0;
+    q->peeked = 0;
 }
 
 void circular_queue_free(struct circular_queue *q)
 {
     mem_free(q);
 }
+
+struct spsc_queue *spsc_queue_create(const unsigned int size, const unsigned int block_size)
+{
+    struct spsc_queue *q;
+
+    if (size == 0 || block_size == 0 || size > UINT_MAX / 2)
+        return NULL;
+
+    q = (struct spsc_queue *)mem_alloc_aligned(sizeof(struct spsc_queue) + (size_t)size * block_size,
+        QUEUE_CACHE_LINE_SIZE);
+    if (q == NULL)
+        return NULL;
+
+    q->size = size;
+    q->block_size = block_size;
+    q->head = 0;
+    q->tail_cache = 0;
+    q->reader_waiting = 0;
+    q->tail = 0;
+    q->head_cache = 0;
+    q->writer_waiting = 0;
+
+    return q;
+}
+
+static inline unsigned int spsc_queue_distance(const struct spsc_queue *q,
+    const unsigned int head, const unsigned int tail)
+{
+    return tail >= head ? tail - head : tail + 2 * q->size - head;
+}
+
+static inline unsigned int spsc_queue_advance(const struct spsc_queue *q,
+    unsigned int index, const unsigned int n)
+{
+    index += n;
+
+    return index >= 2 * q->size ? index - 2 * q->size : index;
+}
+
+/* 下标对应的数据块地址 */
+static inline char *spsc_queue_block(struct spsc_queue *q, const unsigned int index)
+{
+    return q->data + (size_t)(index >= q->size ? index - q->size : index) * q->block_size;
+}
+
+unsigned int spsc_queue_used_size(const struct spsc_queue *q)
+{
+    if (q == NULL)
+        return 0;
+
+    return spsc_queue_distance(q, __atomic_load_n(&q->head, __ATOMIC_ACQUIRE),
+        __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE));
+}
+
+unsigned int spsc_queue_enque(struct spsc_queue *q, const void *data, const unsigned int size)
+{
+    unsigned int n, first;
+    unsigned int tail, avaiable;
+
+    if (q == NULL || data == NULL)
+        return 0;
+
+    tail = q->tail;
+    avaiable = q->size - spsc_queue_distance(q, q->head_cache, tail);
+    if (avaiable < size) {
+        q->head_cache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        avaiable = q->size - spsc_queue_distance(q, q->head_cache, tail);
+    }
+
+    n = size < avaiable ? size : avaiable;
+    if (n == 0)
+        return 0;
+
+    first = q->size - (tail >= q->size ? tail - q->size : tail);
+    if (first > n)
+        first = n;
+
+    memcpy(spsc_queue_block(q, tail), data, (size_t)first * q->block_size);
+    if (n > first)
+        memcpy(q->data, (const char *)data + (size_t)first * q->block_size, (size_t)(n - first) * q->block_size);
+
+    __atomic_store_n(&q->tail, spsc_queue_advance(q, tail, n), __ATOMIC_RELEASE);
+
+    return n;
+}
+
+unsigned int spsc_queue_deque(struct spsc_queue *q, void *data, const unsigned int size)
+{
+    unsigned int n, first;
+    unsigned int head, used;
+
+    if (q == NULL)
+        return 0;
+
+    head = q->head;
+    used = spsc_queue_distance(q, head, q->tail_cache);
+    if (used < size) {
+        q->tail_cache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        used = spsc_queue_distance(q, head, q->tail_cache);
+    }
+
+    n = size < used ? size : used;
+    if (n == 0)
+        return 0;
+
+    if (data != NULL) {
+        first = q->size - (head >= q->size ? head - q->size : head);
+        if (first > n)
+            first = n;
+
+        memcpy(data, spsc_queue_block(q, head), (size_t)first * q->block_size);
+        if (n > first)
+            memcpy((char *)data + (size_t)first * q->block_size, q->data, (size_t)(n - first) * q->block_size);
+    }
+
+    __atomic_store_n(&q->head, spsc_queue_advance(q, head, n), __ATOMIC_RELEASE);
+
+    return n;
+}
+
+void spsc_queue_free(struct spsc_queue *q)
+{
+    mem_free(q);
+}
+
+#if defined (__linux__)
+static inline size_t spsc_queue_shm_size(const unsigned int size, const unsigned int block_size)
+{
+    return sizeof(struct spsc_queue) + (size_t)size * block_size;
+}
+
+struct spsc_queue *spsc_queue_shm_create(const char *name, const unsigned int size,
+    const unsigned int block_size)
+{
+    int fd;
+    size_t bytes;
+    struct spsc_queue *q;
+
+    if (name == NULL || size == 0 || block_size == 0 || size > UINT_MAX / 2)
+        return NULL;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return NULL;
+
+    bytes = spsc_queue_shm_size(size, block_size);
+    if (ftruncate(fd, bytes) < 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    q = (struct spsc_queue *)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (q == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    /* ftruncate出来的内存已清零, 最后写size, 对端看到非0的size才认为初始化完成 */
+    q->block_size = block_size;
+    __atomic_store_n(&q->size, size, __ATOMIC_RELEASE);
+
+    return q;
+}
+
+struct spsc_queue *spsc_queue_shm_attach(const char *name)
+{
+    int fd;
+    struct stat st;
+    unsigned int size;
+    struct spsc_queue *q;
+
+    if (name == NULL)
+        return NULL;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct spsc_queue)) {
+        close(fd);
+        return NULL;
+    }
+
+    q = (struct spsc_queue *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (q == MAP_FAILED)
+        return NULL;
+
+    size = __atomic_load_n(&q->size, __ATOMIC_ACQUIRE);
+    if (size == 0 || q->block_size == 0 || spsc_queue_shm_size(size, q->block_size) != (size_t)st.st_size) {
+        munmap(q, st.st_size);
+        return NULL;
+    }
+
+    return q;
+}
+
+void spsc_queue_shm_detach(struct spsc_queue *q)
+{
+    if (q == NULL)
+        return;
+
+    munmap(q, spsc_queue_shm_size(q->size, q->block_size));
+}
+
+int spsc_queue_shm_unlink(const char *name)
+{
+    if (name == NULL)
+        return -1;
+
+    return shm_unlink(name);
+}
+
+/* 与等待方的登记构成Dekker式的同步: 先全屏障再读标志, 等待方先置标志再检查队列 */
+static inline void spsc_queue_notify(unsigned int *waiting, const int fd)
+{
+    uint64_t one = 1;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED) != 0 && fd >= 0) {
+        if (write(fd, &one, sizeof(one)) < 0)
+            return;
+    }
+}
+
+unsigned int spsc_queue_enque_notify(struct spsc_queue *q, const void *data, const unsigned int size,
+    const int readable_fd)
+{
+    unsigned int n;
+
+    n = spsc_queue_enque(q, data, size);
+    if (n != 0)
+        spsc_queue_notify(&q->reader_waiting, readable_fd);
+
+    return n;
+}
+
+unsigned int spsc_queue_deque_notify(struct spsc_queue *q, void *data, const unsigned int size,
+    const int writable_fd)
+{
+    unsigned int n;
+
+    n = spsc_queue_deque(q, data, size);
+    if (n != 0)
+        spsc_queue_notify(&q->writer_waiting, writable_fd);
+
+    return n;
+}
+
+static inline int spsc_queue_ready(const struct spsc_queue *q, const int readable)
+{
+    unsigned int used;
+
+    used = spsc_queue_used_size(q);
+
+    return readable ? used != 0 : used != q->size;
+}
+
+/*
+ * eventfd中可能残留之前的计数(对端在我们已经看到数据、没读eventfd就返回之后才写入),
+ * poll会立即返回, 所以按截止时间循环, 直到条件满足或者真正超时
+ */
+static int spsc_queue_wait(struct spsc_queue *q, unsigned int *waiting, const int fd,
+    const int readable, const int timeout_ms)
+{
+    int ret;
+    int wait_ms;
+    long long remain;
+    uint64_t count;
+    struct pollfd pfd;
+    struct timespec now, deadline;
+
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    for (;;) {
+        __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+        if (spsc_queue_ready(q, readable)) {
+            __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+            return 1;
+        }
+
+        wait_ms = -1;
+        if (timeout_ms >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            remain = (long long)(deadline.tv_sec - now.tv_sec) * 1000000000LL + (deadline.tv_nsec - now.tv_nsec);
+            if (remain <= 0) {
+                __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+                return 0;
+            }
+            wait_ms = (int)((remain + 999999LL) / 1000000LL);
+        }
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        do {
+            ret = poll(&pfd, 1, wait_ms);
+        } while (ret < 0 && errno == EINTR);
+        __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+        if (ret < 0)
+            return -1;
+
+        if (ret > 0 && read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            return -1;
+    }
+}
+
+int spsc_queue_wait_readable(struct spsc_queue *q, const int readable_fd, const int timeout_ms)
+{
+    if (q == NULL || readable_fd < 0)
+        return -1;
+
+    return spsc_queue_wait(q, &q->reader_waiting, readable_fd, 1, timeout_ms);
+}
+
+int spsc_queue_wait_writable(struct spsc_queue *q, const int writable_fd, const int timeout_ms)
+{
+    if (q == NULL || writable_fd < 0)
+        return -1;
+
+    return spsc_queue_wait(q, &q->writer_waiting, writable_fd, 0, timeout_ms);
+}
+#endif
+
+struct mpmc_slot {
+    unsigned int seq;
+    unsigned int reserved;
+    char data[0];
+};
+
+struct mpmc_queue *mpmc_queue_create(const unsigned int size, const unsigned int block_size)
+{
+    unsigned int i, n;
+    unsigned int slot_size;
+    struct mpmc_queue *q;
+    struct mpmc_slot *slot;
+
+    if (size == 0 || block_size == 0 || size > (1U << 30) || block_size > UINT_MAX - 2 * sizeof(struct mpmc_slot))
+        return NULL;
+
+    for (n = 1; n < size; n <<= 1)
+        continue;
+
+    slot_size = (sizeof(struct mpmc_slot) + block_size + 7) & ~7U;
+    q = (struct mpmc_queue *)mem_alloc_aligned(sizeof(struct mpmc_queue) + (size_t)n * slot_size,
+        QUEUE_CACHE_LINE_SIZE);
+    if (q == NULL)
+        return NULL;
+
+    q->size = n;
+    q->mask = n - 1;
+    q->block_size = block_size;
+    q->slot_size = slot_size;
+    q->enque_pos = 0;
+    q->deque_pos = 0;
+    q->not_full = 0;
+    q->not_empty = 0;
+    q->enque_waiters = 0;
+    q->deque_waiters = 0;
+    for (i = 0; i < n; i++) {
+        slot = (struct mpmc_slot *)(q->data + (size_t)i * slot_size);
+        slot->seq = i;
+    }
+
+    return q;
+}
+
+static inline struct mpmc_slot *mpmc_queue_slot(struct mpmc_queue *q, const unsigned int pos)
+{
+    return (struct mpmc_slot *)(q->data + (size_t)(pos & q->mask) * q->slot_size);
+}
+
+#if defined (__linux__)
+/* 对方在等待时才改变futex的值并唤醒, 先用全屏障保证等待者检查队列和我们检查等待者不会同时错过 */
+static inline void mpmc_queue_wake(unsigned int *futex, unsigned int *waiters)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiters, __ATOMIC_RELAXED) != 0) {
+        __atomic_fetch_add(futex, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, futex, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+#else
+#define mpmc_queue_wake(futex, waiters) do { } while (0)
+#endif
+
+int mpmc_queue_try_enque(struct mpmc_queue *q, const void *data)
+{
+    int dif;
+    unsigned int pos, seq;
+    struct mpmc_slot *slot;
+
+    if (q == NULL || data == NULL)
+        return 0;
+
+    pos = __atomic_load_n(&q->enque_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = mpmc_queue_slot(q, pos);
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        dif = (int)(seq - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->enque_pos, &pos, pos + 1, true,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&q->enque_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(slot->data, data, q->block_size);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    mpmc_queue_wake(&q->not_empty, &q->deque_waiters);
+
+    return 1;
+}
+
+int mpmc_queue_try_deque(struct mpmc_queue *q, void *data)
+{
+    int dif;
+    unsigned int pos, seq;
+    struct mpmc_slot *slot;
+
+    if (q == NULL)
+        return 0;
+
+    pos = __atomic_load_n(&q->deque_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = mpmc_queue_slot(q, pos);
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        dif = (int)(seq - (pos + 1));
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->deque_pos, &pos, pos + 1, true,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&q->deque_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (data != NULL)
+        memcpy(data, slot->data, q->block_size);
+    __atomic_store_n(&slot->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+    mpmc_queue_wake(&q->not_full, &q->enque_waiters);
+
+    return 1;
+}
+
+#if defined (__linux__)
+/* 登记为等待者后再试一次, 仍然失败才在futex上睡眠, 超时返回0 */
+static int mpmc_queue_wait(struct mpmc_queue *q, unsigned int *futex, unsigned int *waiters,
+    int (*try_op)(struct mpmc_queue *, void *), void *data, const int timeout_ms)
+{
+    int ret;
+    long long remain;
+    unsigned int val;
+    struct timespec now, deadline, ts;
+
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    for (;;) {
+        if (try_op(q, data))
+            return 1;
+
+        val = __atomic_load_n(futex, __ATOMIC_ACQUIRE);
+        __atomic_fetch_add(waiters, 1, __ATOMIC_SEQ_CST);
+        ret = try_op(q, data);
+        if (!ret) {
+            if (timeout_ms >= 0) {
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                remain = (long long)(deadline.tv_sec - now.tv_sec) * 1000000000LL + (deadline.tv_nsec - now.tv_nsec);
+                if (remain <= 0) {
+                    __atomic_fetch_sub(waiters, 1, __ATOMIC_RELAXED);
+                    return 0;
+                }
+                ts.tv_sec = remain / 1000000000LL;
+                ts.tv_nsec = remain % 1000000000LL;
+            }
+            syscall(SYS_futex, futex, FUTEX_WAIT_PRIVATE, val, timeout_ms >= 0 ? &ts : NULL, NULL, 0);
+        }
+        __atomic_fetch_sub(waiters, 1, __ATOMIC_RELAXED);
+        if (ret)
+            return 1;
+    }
+}
+
+static int mpmc_queue_try_enque_op(struct mpmc_queue *q, void *data)
+{
+    return mpmc_queue_try_enque(q, data);
+}
+
+static int mpmc_queue_try_deque_op(struct mpmc_queue *q, void *data)
+{
+    return mpmc_queue_try_deque(q, data);
+}
+
+int mpmc_queue_enque(struct mpmc_queue *q, const void *data, const int timeout_ms)
+{
+    if (q == NULL || data == NULL)
+        return 0;
+
+    return mpmc_queue_wait(q, &q->not_full, &q->enque_waiters, mpmc_queue_try_enque_op,
+        (void *)data, timeout_ms);
+}
+
+int mpmc_queue_deque(struct mpmc_queue *q, void *data, const int timeout_ms)
+{
+    if (q == NULL)
+        return 0;
+
+    return mpmc_queue_wait(q, &q->not_empty, &q->deque_waiters, mpmc_queue_try_deque_op,
+        data, timeout_ms);
+}
+#endif
+
+unsigned int mpmc_queue_used_size(const struct mpmc_queue *q)
+{
+    unsigned int used;
+
+    if (q == NULL)
+        return 0;
+
+    used = __atomic_load_n(&q->enque_pos, __ATOMIC_RELAXED) - __atomic_load_n(&q->deque_pos, __ATOMIC_RELAXED);
+
+    return (int)used < 0 ? 0 : (used > q->size ? q->size : used);
+}
+
+void mpmc_queue_free(struct mpmc_queue *q)
+{
+    mem_free(q);
+}
+
+#define RECORD_QUEUE_HEADER_SIZE    sizeof(unsigned int)
+#define RECORD_QUEUE_PADDING        0xFFFFFFFFU
+#define RECORD_QUEUE_ALIGN(len)     (((len) + RECORD_QUEUE_HEADER_SIZE - 1) & ~(RECORD_QUEUE_HEADER_SIZE - 1))
+
+struct record_queue *record_queue_create(const unsigned int size)
+{
+    unsigned int bytes;
+    struct record_queue *q;
+
+    bytes = size & ~(RECORD_QUEUE_HEADER_SIZE - 1);
+    if (bytes <= RECORD_QUEUE_HEADER_SIZE)
+        return NULL;
+
+    q = (struct record_queue *)mem_alloc(sizeof(struct record_queue) + bytes);
+    if (q == NULL)
+        return NULL;
+
+    q->size = bytes;
+    q->used_size = 0;
+    q->front = 0;
+    q->rear = 0;
+
+    return q;
+}
+
+unsigned int record_queue_used_size(const struct record_queue *q)
+{
+    if (q == NULL)
+        return 0;
+
+    return q->used_size;
+}
+
+unsigned int record_queue_avaiable_size(const struct record_queue *q)
+{
+    if (q == NULL)
+        return 0;
+
+    return q->size - q->used_size;
+}
+
+int record_queue_empty(const struct record_queue *q)
+{
+    if (q == NULL)
+        return 0;
+
+    return q->used_size == 0;
+}
+
+static inline unsigned int record_queue_header(const struct record_queue *q, const unsigned int pos)
+{
+    return *(const unsigned int *)(q->data + pos);
+}
+
+int record_queue_enque(struct record_queue *q, const void *data, const unsigned int len)
+{
+    unsigned int need, tail_room;
+
+    if (q == NULL || data == NULL || len == 0 || len > q->size - RECORD_QUEUE_HEADER_SIZE)
+        return 0;
+
+    /* 空队列从头开始, 连续空间最大 */
+    if (q->used_size == 0)
+        q->front = q->rear = 0;
+
+    need = RECORD_QUEUE_ALIGN(RECORD_QUEUE_HEADER_SIZE + len);
+    if (need > q->size - q->used_size)
+        return 0;
+
+    if (q->rear >= q->front) {
+        tail_room = q->size - q->rear;
+        if (need > tail_room) {
+            if (need > q->front)
+                return 0;
+
+            *(unsigned int *)(q->data + q->rear) = RECORD_QUEUE_PADDING;
+            q->used_size += tail_room;
+            q->rear = 0;
+        }
+    } else if (need > q->front - q->rear) {
+        return 0;
+    }
+
+    *(unsigned int *)(q->data + q->rear) = len;
+    memcpy(q->data + q->rear + RECORD_QUEUE_HEADER_SIZE, data, len);
+    q->rear += need;
+    if (q->rear == q->size)
+        q->rear = 0;
+    q->used_size += need;
+
+    return 1;
+}
+
+/* 跳过末尾的填充, 返回队列头记录的偏移 */
+static inline unsigned int record_queue_head(const struct record_queue *q)
+{
+    if (record_queue_header(q, q->front) == RECORD_QUEUE_PADDING)
+        return 0;
+
+    return q->front;
+}
+
+unsigned int record_queue_front(const struct record_queue *q)
+{
+    if (q == NULL || q->used_size == 0)
+        return 0;
+
+    return record_queue_header(q, record_queue_head(q));
+}
+
+unsigned int record_queue_deque(struct record_queue *q, void *data, const unsigned int size)
+{
+    unsigned int pos, len, need;
+
+    if (q == NULL || q->used_size == 0)
+        return 0;
+
+    pos = record_queue_head(q);
+    if (pos != q->front)
+        q->used_size -= q->size - q->front;
+
+    len = record_queue_header(q, pos);
+    if (data != NULL)
+        memcpy(data, q->data + pos + RECORD_QUEUE_HEADER_SIZE, len < size ? len : size);
+
+    need = RECORD_QUEUE_ALIGN(RECORD_QUEUE_HEADER_SIZE + len);
+    q->front = pos + need;
+    if (q->front == q->size)
+        q->front = 0;
+    q->used_size -= need;
+
+    return len;
+}
+
+void record_queue_clear(struct record_queue *q)
+{
+    if (q == NULL)
+        return;
+
+    q->used_size = 0;
+    q->front = 0;
+    q->rear = 0;
+}
+
+void record_queue_free(struct record_queue *q)
+{
+    mem_free(q);
+}
@@ -9,6 +9,9 @@ struct circular_queue {
     unsigned int used_size;     /* 已被使用的数据块个数 */
     unsigned int front;         /* 头指针 */
     unsigned int rear;          /* 尾指针 */
+    unsigned int mask;          /* size为2的幂时等于size - 1, 否则为0 */
+    unsigned int reserved;      /* 最近一次reserve给出的, 还没有commit的块数 */
+    unsigned int peeked;        /* 最近一次peek给出的, 还没有release的块数 */
     char data[0];               /* 数据块 */
 };
 
@@ -58,6 +61,36 @@ extern unsigned int circular_queue_enque(struct circular_queue *q, const void *d
  */
 extern unsigned int circular_queue_deque(struct circular_queue *q, void *data, const unsigned int size);
 
+/**
+ * @brief circular_queue_reserve 在队列尾预留连续的空闲数据块, 调用者直接写入后用circular_queue_commit入队
+ * @param q 循环队列
+ * @param size 希望预留的数据块个数
+ * @param count 返回实际预留的个数, 不会跨过队列末尾, 可能小于size
+ * @return 返回第一个数据块的地址, 队列满时返回NULL
+ */
+extern void *circular_queue_reserve(struct circular_queue *q, const unsigned int size, unsigned int *count);
+
+/**
+ * @brief circular_queue_commit 将预留的前size个数据块入队
+ * @return 返回入队的数据个数, 不超过最近一次circular_queue_reserve给出的个数
+ */
+extern unsigned int circular_queue_commit(struct circular_queue *q, const unsigned int size);
+
+/**
+ * @brief circular_queue_peek 取得队列头连续数据块的地址, 调用者原地读取后用circular_queue_release出队
+ * @param q 循环队列
+ * @param size 希望读取的数据块个数
+ * @param count 返回实际可读的个数, 不会跨过队列末尾, 可能小于size
+ * @return 返回第一个数据块的地址, 队列空时返回NULL
+ */
+extern const void *circular_queue_peek(struct circular_queue *q, const unsigned int size, unsigned int *count);
+
+/**
+ * @brief circular_queue_release 将队列头的size个数据块出队
+ * @return 返回出队的数据个数, 不超过最近一次circular_queue_peek给出的个数
+ */
+extern unsigned int circular_queue_release(struct circular_queue *q, const unsigned int size);
+
 /**
  * @brief circular_queue_front 只读取队列头的数据, 不出队该数据
  * @param q 循环队列
@@ -83,6 +116,255 @@ extern void circular_queue_clear(struct circular_queue *q);
  */
 extern void circular_queue_free(struct circular_queue *q);
 
+#define QUEUE_CACHE_LINE_SIZE   64
+
+/*
+ * 单生产者单消费者的无锁循环队列, head只由消费者写, tail只由生产者写, 分别放在不同的cache line上,
+ * 下标在[0, 2 * size)内循环, 以区分队列满和空; 各自缓存对方的下标, 只有看起来满或空时才重新读取
+ */
+struct spsc_queue {
+    unsigned int size;          /* 数据块的个数 */
+    unsigned int block_size;    /* 数据块的大小 */
+    unsigned int head __attribute__((aligned(QUEUE_CACHE_LINE_SIZE)));  /* 消费者 */
+    unsigned int tail_cache;
+    unsigned int tail __attribute__((aligned(QUEUE_CACHE_LINE_SIZE)));  /* 生产者 */
+    unsigned int head_cache;
+    /* 等待标志只在睡眠前后写, 各占一条cache line, 通知方平时读到的是不变的共享副本 */
+    unsigned int reader_waiting __attribute__((aligned(QUEUE_CACHE_LINE_SIZE)));  /* 消费者在eventfd上等待数据 */
+    unsigned int writer_waiting __attribute__((aligned(QUEUE_CACHE_LINE_SIZE)));  /* 生产者在eventfd上等待空间 */
+    char data[0] __attribute__((aligned(QUEUE_CACHE_LINE_SIZE)));       /* 数据块 */
+};
+
+/**
+ * @brief spsc_queue_create 创建一个指定大小的单生产者单消费者队列
+ * @param size 数据块的个数
+ * @param block_size 数据块的大小
+ * @return 返回队列指针
+ */
+extern struct spsc_queue *spsc_queue_create(const unsigned int size, const unsigned int block_size);
+
+/**
+ * @brief spsc_queue_used_size 检查队列已使用的大小, 生产者和消费者都可以调用
+ */
+extern unsigned int spsc_queue_used_size(const struct spsc_queue *q);
+
+/**
+ * @brief spsc_queue_enque 将数据入队, 只能由生产者调用
+ * @param q 队列
+ * @param data 连续的数据首地址
+ * @param size 入队数据个数
+ * @return 返回入队的数据个数
+ */
+extern unsigned int spsc_queue_enque(struct spsc_queue *q, const void *data, const unsigned int size);
+
+/**
+ * @brief spsc_queue_deque 将数据出队, 只能由消费者调用
+ * @param q 队列
+ * @param data 接受数据的地址, 为NULL时直接丢弃
+ * @param size 出队的数据个数
+ * @return 返回出队的数据个数
+ */
+extern unsigned int spsc_queue_deque(struct spsc_queue *q, void *data, const unsigned int size);
+
+/**
+ * @brief spsc_queue_free 释放队列占用的内存
+ */
+extern void spsc_queue_free(struct spsc_queue *q);
+
+#if defined (__linux__)
+/*
+ * 跨进程使用时把spsc_queue放在命名的共享内存(shm_open)中, 下标本来就是无锁的;
+ * 等待和唤醒用两个eventfd, 由调用者创建(建议EFD_NONBLOCK)并通过fork或unix socket传给对端:
+ * readable_fd由生产者通知消费者有数据, writable_fd由消费者通知生产者有空间,
+ * 只有对端登记了等待时才写eventfd
+ */
+
+/**
+ * @brief spsc_queue_shm_create 在新的共享内存中创建队列, 同名的共享内存已存在时失败
+ * @param name shm_open的名字, 以'/'开头
+ * @param size 数据块的个数
+ * @param block_size 数据块的大小
+ * @return 返回映射后的队列指针
+ */
+extern struct spsc_queue *spsc_queue_shm_create(const char *name, const unsigned int size,
+    const unsigned int block_size);
+
+/**
+ * @brief spsc_queue_shm_attach 映射已由对端创建的队列
+ * @return 共享内存不存在或大小不符时返回NULL
+ */
+extern struct spsc_queue *spsc_queue_shm_attach(const char *name);
+
+/**
+ * @brief spsc_queue_shm_detach 解除本进程的映射, 不删除共享内存
+ */
+extern void spsc_queue_shm_detach(struct spsc_queue *q);
+
+/**
+ * @brief spsc_queue_shm_unlink 删除共享内存的名字, 已有的映射仍然有效
+ */
+extern int spsc_queue_shm_unlink(const char *name);
+
+/**
+ * @brief spsc_queue_enque_notify 入队后, 如果消费者在等待则写readable_fd唤醒它
+ * @return 返回入队的数据个数
+ */
+extern unsigned int spsc_queue_enque_notify(struct spsc_queue *q, const void *data, const unsigned int size,
+    const int readable_fd);
+
+/**
+ * @brief spsc_queue_deque_notify 出队后, 如果生产者在等待则写writable_fd唤醒它
+ * @return 返回出队的数据个数
+ */
+extern unsigned int spsc_queue_deque_notify(struct spsc_queue *q, void *data, const unsigned int size,
+    const int writable_fd);
+
+/**
+ * @brief spsc_queue_wait_readable 消费者等待队列非空
+ * @param timeout_ms 最长等待的毫秒数, 小于0时一直等待
+ * @return 队列非空返回1, 超时返回0, 出错返回-1
+ */
+extern int spsc_queue_wait_readable(struct spsc_queue *q, const int readable_fd, const int timeout_ms);
+
+/**
+ * @brief spsc_queue_wait_writable 生产者等待队列不满
+ * @param timeout_ms 最长等待的毫秒数, 小于0时一直等待
+ * @return 队列不满返回1, 超时返回0, 出错返回-1
+ */
+extern int spsc_queue_wait_writable(struct spsc_queue *q, const int writable_fd, const int timeout_ms);
+#endif
+
+/*
+ * 多生产者多消费者的有界队列(Vyukov), 每个槽带一个序号: 序号等于入队位置时可写, 等于位置加1时可读,
+ * 生产者和消费者各自用CAS抢占位置, 之后只访问自己的槽; 阻塞版本在linux上用futex等待
+ */
+struct mpmc_queue {
+    unsigned int size;          /* 槽的个数, 向上取整到2的幂 */
+    unsigned int mask;
+    unsigned int block_size;    /* 数据块的大小 */
+    unsigned int slot_size;     /* 序号加数据块, 按8字节对齐 */
+    unsigned int enque_pos __attribute__((aligned(QUEUE_CACHE_LINE_SIZE)));
+    unsigned int deque_pos __attribute__((aligned(QUEUE_CACHE_LINE_SIZE)));
+    unsigned int not_full;      /* futex, 有数据出队且有生产者在等待时加1 */
+    unsigned int not_empty;     /* futex, 有数据入队且有消费者在等待时加1 */
+    unsigned int enque_waiters;
+    unsigned int deque_waiters;
+    char data[0] __attribute__((aligned(QUEUE_CACHE_LINE_SIZE)));
+};
+
+/**
+ * @brief mpmc_queue_create 创建一个多生产者多消费者队列
+ * @param size 数据块的个数, 向上取整到2的幂
+ * @param block_size 数据块的大小
+ * @return 返回队列指针
+ */
+extern struct mpmc_queue *mpmc_queue_create(const unsigned int size, const unsigned int block_size);
+
+/**
+ * @brief mpmc_queue_try_enque 入队一个数据块, 不阻塞
+ * @return 队列满时返回0
+ */
+extern int mpmc_queue_try_enque(struct mpmc_queue *q, const void *data);
+
+/**
+ * @brief mpmc_queue_try_deque 出队一个数据块, 不阻塞
+ * @param data 接受数据的地址, 为NULL时直接丢弃
+ * @return 队列空时返回0
+ */
+extern int mpmc_queue_try_deque(struct mpmc_queue *q, void *data);
+
+#if defined (__linux__)
+/**
+ * @brief mpmc_queue_enque 入队一个数据块, 队列满时等待
+ * @param timeout_ms 最长等待的毫秒数, 小于0时一直等待
+ * @return 超时返回0
+ */
+extern int mpmc_queue_enque(struct mpmc_queue *q, const void *data, const int timeout_ms);
+
+/**
+ * @brief mpmc_queue_deque 出队一个数据块, 队列空时等待
+ * @param timeout_ms 最长等待的毫秒数, 小于0时一直等待
+ * @return 超时返回0
+ */
+extern int mpmc_queue_deque(struct mpmc_queue *q, void *data, const int timeout_ms);
+#endif
+
+/**
+ * @brief mpmc_queue_used_size 队列中数据块个数的近似值
+ */
+extern unsigned int mpmc_queue_used_size(const struct mpmc_queue *q);
+
+/**
+ * @brief mpmc_queue_free 释放队列占用的内存
+ */
+extern void mpmc_queue_free(struct mpmc_queue *q);
+
+/*
+ * 按字节存放变长记录的循环队列, 每条记录前有4字节的长度, 整条记录按4字节对齐且不跨过队列末尾,
+ * 末尾放不下时写一个填充标记, 剩余的空间作废, 从头开始写
+ */
+struct record_queue {
+    unsigned int size;          /* 缓冲区的字节数 */
+    unsigned int used_size;     /* 已被使用的字节数, 包括长度, 对齐和末尾填充 */
+    unsigned int front;         /* 头偏移 */
+    unsigned int rear;          /* 尾偏移 */
+    char data[0];
+};
+
+/**
+ * @brief record_queue_create 创建一个变长记录队列
+ * @param size 缓冲区的字节数, 向下对齐到4字节
+ * @return 返回队列指针
+ */
+extern struct record_queue *record_queue_create(const unsigned int size);
+
+/**
+ * @brief record_queue_used_size 已使用的字节数
+ */
+extern unsigned int record_queue_used_size(const struct record_queue *q);
+
+/**
+ * @brief record_queue_avaiable_size 剩余的字节数, 因为长度和末尾填充, 能入队的记录会比它小
+ */
+extern unsigned int record_queue_avaiable_size(const struct record_queue *q);
+
+/**
+ * @brief record_queue_empty 判断队列是否为空
+ */
+extern int record_queue_empty(const struct record_queue *q);
+
+/**
+ * @brief record_queue_enque 将一条记录入队
+ * @param data 记录的首地址
+ * @param len 记录的字节数, 不能为0, 这样出队返回0只表示队列为空
+ * @return 空间不足或len为0返回0
+ */
+extern int record_queue_enque(struct record_queue *q, const void *data, const unsigned int len);
+
+/**
+ * @brief record_queue_front 队列头记录的字节数, 不出队该记录
+ * @return 队列为空返回0, 记录的长度不会为0
+ */
+extern unsigned int record_queue_front(const struct record_queue *q);
+
+/**
+ * @brief record_queue_deque 将一条记录出队
+ * @param data 接受数据的地址, 为NULL时直接丢弃
+ * @param size data的大小, 超过的部分被截断
+ * @return 返回记录的字节数, 队列为空返回0, 记录的长度不会为0
+ */
+extern unsigned int record_queue_deque(struct record_queue *q, void *data, const unsigned int size);
+
+/**
+ * @brief record_queue_clear 清空整个队列
+ */
+extern void record_queue_clear(struct record_queue *q);
+
+/**
+ * @brief record_queue_free 释放队列占用的内存
+ */
+extern void record_queue_free(struct record_queue *q);
+
 typedef linkedlist_t queue_t;
 
 /**
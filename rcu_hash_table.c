@@ -0,0 +1,391 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rcu_hash_table.h"
+
+/* 待释放的节点积累到这么多时尝试回收一次 */
+#define RCU_HASH_TABLE_RECLAIM_BATCH    64U
+
+/* 桶数超过该值后不再扩容 */
+#define RCU_HASH_TABLE_MAX_BUCKETS      0x40000000U
+
+#define rcu_load(p)             __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define rcu_assign(p, v)        __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static struct rcu_hash_table_buckets *rcu_hash_table_alloc_buckets(const unsigned int mask)
+{
+    unsigned int i;
+    struct rcu_hash_table_buckets *b;
+
+    b = (struct rcu_hash_table_buckets *) malloc(sizeof(*b) + (mask + 1) * sizeof(struct hlist_head));
+    if (b) {
+        b->mask = mask;
+        for (i = 0; i <= mask; i++)
+            INIT_HLIST_HEAD(b->heads + i);
+    }
+
+    return b;
+}
+
+/* 与hlist_add_head相同, 但最后才用release语义把节点挂到桶头 */
+static inline void rcu_hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+{
+    struct hlist_node *first = h->first;
+
+    __atomic_store_n(&n->next, first, __ATOMIC_RELAXED);
+    n->pprev = &h->first;
+    if (first)
+        first->pprev = &n->next;
+    rcu_assign(&h->first, n);
+}
+
+/* 与__hlist_del相同, 不修改n->next, 正在访问n的读者还能继续往后走 */
+static inline void rcu_hlist_del(struct hlist_node *n)
+{
+    struct hlist_node *next = n->next;
+    struct hlist_node **pprev = n->pprev;
+
+    rcu_assign(pprev, next);
+    if (next)
+        next->pprev = pprev;
+}
+
+rcu_hash_table_t *rcu_hash_table_create(const unsigned int size,
+                            const hash_table_index_func_t hash,
+                            const hash_table_release_func_t release)
+{
+    unsigned int mask;
+    rcu_hash_table_t *t;
+
+    if (!size || !hash || !release || size > RCU_HASH_TABLE_MAX_BUCKETS)
+        return NULL;
+
+    for (mask = 1; mask < size; mask <<= 1)
+        continue;
+
+    t = (rcu_hash_table_t *) malloc(sizeof(*t));
+    if (!t)
+        return NULL;
+
+    t->table[0] = rcu_hash_table_alloc_buckets(mask - 1);
+    if (!t->table[0]) {
+        free(t);
+        return NULL;
+    }
+
+    t->table[1] = NULL;
+    t->seq = 0;
+    t->rehash_index = 0;
+    t->count = 0;
+    t->epoch = 1;
+    t->readers = NULL;
+    t->hash = hash;
+    t->release = release;
+    t->nr_retired = 0;
+    t->max_retired = 0;
+    t->reclaim_at = RCU_HASH_TABLE_RECLAIM_BATCH;
+    t->retired = NULL;
+
+    return t;
+}
+
+struct rcu_hash_table_reader *rcu_hash_table_reader_register(rcu_hash_table_t *__restrict t)
+{
+    int unused;
+    struct rcu_hash_table_reader *r;
+
+    if (!t)
+        return NULL;
+
+    for (r = rcu_load(&t->readers); r; r = r->next) {
+        unused = 0;
+        if (__atomic_compare_exchange_n(&r->in_use, &unused, 1, false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return r;
+    }
+
+    if (posix_memalign((void **) &r, sizeof(*r), sizeof(*r)) != 0)
+        return NULL;
+
+    r->epoch = 0;
+    r->in_use = 1;
+    r->next = __atomic_load_n(&t->readers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&t->readers, &r->next, r, true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        continue;
+
+    return r;
+}
+
+void rcu_hash_table_reader_unregister(struct rcu_hash_table_reader *__restrict r)
+{
+    if (r) {
+        __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+    }
+}
+
+static struct hlist_node *rcu_hash_table_search(const struct rcu_hash_table_buckets *__restrict b,
+                    const unsigned int hash, const void *__restrict key,
+                    const hash_table_equal_func_t equal)
+{
+    struct hlist_node *node;
+
+    for (node = rcu_load(&b->heads[hash & b->mask].first); node; node = rcu_load(&node->next)) {
+        if (hash_table_node_entry(node)->hash == hash && (!equal || equal(node, key)))
+            return node;
+    }
+
+    return NULL;
+}
+
+/*
+ * 扩容迁移时节点会被挪到新表, 正在旧链上遍历的读者可能被带到新链上而漏掉后面的节点,
+ * 所以没找到时要检查seq, 迁移过程中发生过变化就重试. 不扩容时读者不会重试,
+ * 扩容期间写者每次操作最多迁移RCU_HASH_TABLE_REHASH_STEP个桶, 重试次数不超过写者操作的次数
+ */
+struct hlist_node *rcu_hash_table_find_key(rcu_hash_table_t *__restrict t,
+                    const unsigned int hash, const void *__restrict key,
+                    const hash_table_equal_func_t equal)
+{
+    unsigned int i;
+    unsigned int seq;
+    struct hlist_node *node;
+    struct rcu_hash_table_buckets *b;
+
+    if (!t)
+        return NULL;
+
+    for (;;) {
+        seq = rcu_load(&t->seq);
+        for (i = 0; i < 2; i++) {
+            b = rcu_load(&t->table[i]);
+            if (b) {
+                node = rcu_hash_table_search(b, hash, key, equal);
+                if (node)
+                    return node;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (!(seq & 1) && __atomic_load_n(&t->seq, __ATOMIC_RELAXED) == seq)
+            return NULL;
+    }
+}
+
+static void rcu_hash_table_free_retired(rcu_hash_table_t *__restrict t,
+                const struct rcu_hash_table_retired *__restrict r)
+{
+    if (r->node)
+        t->release(r->node);
+    else
+        free(r->buckets);
+}
+
+void rcu_hash_table_reclaim(rcu_hash_table_t *__restrict t)
+{
+    unsigned int i;
+    unsigned int j;
+    unsigned long min;
+    unsigned long epoch;
+    struct rcu_hash_table_reader *r;
+
+    if (!t || !t->nr_retired)
+        return;
+
+    min = __atomic_add_fetch(&t->epoch, 1, __ATOMIC_SEQ_CST);
+    for (r = rcu_load(&t->readers); r; r = r->next) {
+        epoch = __atomic_load_n(&r->epoch, __ATOMIC_ACQUIRE);
+        if (epoch && epoch < min)
+            min = epoch;
+    }
+
+    /* 进入读临界区时epoch比摘除时的epoch大的读者不可能再看到这些节点 */
+    for (i = 0, j = 0; i < t->nr_retired; i++) {
+        if (t->retired[i].epoch < min)
+            rcu_hash_table_free_retired(t, t->retired + i);
+        else
+            t->retired[j++] = t->retired[i];
+    }
+    t->nr_retired = j;
+}
+
+/* 等待所有在epoch及更早进入读临界区的读者离开 */
+static void rcu_hash_table_synchronize(rcu_hash_table_t *__restrict t, const unsigned long epoch)
+{
+    unsigned long e;
+    struct rcu_hash_table_reader *r;
+
+    __atomic_add_fetch(&t->epoch, 1, __ATOMIC_SEQ_CST);
+    for (r = rcu_load(&t->readers); r; r = r->next) {
+        do {
+            e = __atomic_load_n(&r->epoch, __ATOMIC_ACQUIRE);
+        } while (e && e <= epoch);
+    }
+}
+
+static void rcu_hash_table_retire(rcu_hash_table_t *__restrict t,
+                struct hlist_node *__restrict node, struct rcu_hash_table_buckets *__restrict b)
+{
+    unsigned int max;
+    struct rcu_hash_table_retired r;
+    struct rcu_hash_table_retired *retired;
+
+    r.epoch = __atomic_load_n(&t->epoch, __ATOMIC_RELAXED);
+    r.node = node;
+    r.buckets = b;
+    /*
+     * 有读者停在读临界区时回收不掉多少, 下次回收的阈值取剩余个数的两倍,
+     * 避免之后每次删除都扫描整个待释放数组
+     */
+    if (t->nr_retired >= t->reclaim_at) {
+        rcu_hash_table_reclaim(t);
+        t->reclaim_at = t->nr_retired * 2;
+        if (t->reclaim_at < RCU_HASH_TABLE_RECLAIM_BATCH)
+            t->reclaim_at = RCU_HASH_TABLE_RECLAIM_BATCH;
+    }
+
+    if (t->nr_retired == t->max_retired) {
+        max = t->max_retired ? t->max_retired * 2 : RCU_HASH_TABLE_RECLAIM_BATCH;
+        retired = (struct rcu_hash_table_retired *) realloc(t->retired, max * sizeof(*retired));
+        if (!retired) {
+            /* 没有内存记录待释放的节点, 只能同步等待读者离开后直接释放 */
+            rcu_hash_table_synchronize(t, r.epoch);
+            rcu_hash_table_free_retired(t, &r);
+            return;
+        }
+
+        t->retired = retired;
+        t->max_retired = max;
+    }
+
+    t->retired[t->nr_retired++] = r;
+}
+
+/*
+ * 把旧表中最多step个桶迁移到新表, 这一批迁移前后各增加一次seq,
+ * 全部迁移完成后摘下旧表, 宽限期过后释放
+ */
+static void rcu_hash_table_rehash(rcu_hash_table_t *__restrict t, unsigned int step)
+{
+    bool moving;
+    struct hlist_node *node;
+    struct hlist_head *head;
+    struct rcu_hash_table_buckets *old;
+    struct rcu_hash_table_buckets *new;
+
+    old = t->table[1];
+    if (!old)
+        return;
+
+    new = t->table[0];
+    moving = false;
+    for (; step && t->rehash_index <= old->mask; step--, t->rehash_index++) {
+        head = old->heads + t->rehash_index;
+        if (!head->first)
+            continue;
+
+        if (!moving) {
+            __atomic_store_n(&t->seq, t->seq + 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            moving = true;
+        }
+        while ((node = head->first) != NULL) {
+            rcu_hlist_del(node);
+            rcu_hlist_add_head(node, new->heads + (hash_table_node_entry(node)->hash & new->mask));
+        }
+    }
+    if (moving)
+        rcu_assign(&t->seq, t->seq + 1);
+
+    if (t->rehash_index > old->mask) {
+        rcu_assign(&t->table[1], NULL);
+        t->rehash_index = 0;
+        rcu_hash_table_retire(t, NULL, old);
+    }
+}
+
+/* 新表先发布到table[0], 旧表挪到table[1], 之后的add/del逐步迁移 */
+static void rcu_hash_table_grow(rcu_hash_table_t *__restrict t)
+{
+    struct rcu_hash_table_buckets *old;
+    struct rcu_hash_table_buckets *new;
+
+    old = t->table[0];
+    if (t->table[1] || old->mask + 1 >= RCU_HASH_TABLE_MAX_BUCKETS)
+        return;
+
+    new = rcu_hash_table_alloc_buckets((old->mask << 1) | 1);
+    if (!new)
+        return;
+
+    t->rehash_index = 0;
+    rcu_assign(&t->table[1], old);
+    rcu_assign(&t->table[0], new);
+}
+
+bool rcu_hash_table_add(rcu_hash_table_t *__restrict t, struct hlist_node *__restrict node)
+{
+    unsigned int hash;
+    struct rcu_hash_table_buckets *b;
+
+    if (!t || !node)
+        return false;
+
+    rcu_hash_table_rehash(t, RCU_HASH_TABLE_REHASH_STEP);
+
+    /* insert directly, no checking if has the same key */
+    hash = t->hash(node);
+    hash_table_node_entry(node)->hash = hash;
+    b = t->table[0];
+    rcu_hlist_add_head(node, b->heads + (hash & b->mask));
+    if (++t->count > b->mask + 1)
+        rcu_hash_table_grow(t);
+
+    return true;
+}
+
+void rcu_hash_table_del(rcu_hash_table_t *__restrict t, struct hlist_node *__restrict node)
+{
+    if (!t || !node)
+        return;
+
+    rcu_hlist_del(node);
+    t->count--;
+    rcu_hash_table_retire(t, node, NULL);
+    rcu_hash_table_rehash(t, RCU_HASH_TABLE_REHASH_STEP);
+}
+
+void rcu_hash_table_destory(rcu_hash_table_t *__restrict t)
+{
+    unsigned int i;
+    unsigned int j;
+    struct hlist_node *tmp;
+    struct hlist_node *node;
+    struct rcu_hash_table_reader *r;
+    struct rcu_hash_table_reader *next;
+
+    if (t) {
+        for (i = 0; i < t->nr_retired; i++)
+            rcu_hash_table_free_retired(t, t->retired + i);
+        free(t->retired);
+
+        for (j = 0; j < 2; j++) {
+            if (!t->table[j])
+                continue;
+
+            for (i = 0; i <= t->table[j]->mask; i++) {
+                for (node = t->table[j]->heads[i].first; node; node = tmp) {
+                    tmp = node->next;
+                    t->release(node);
+                }
+            }
+            free(t->table[j]);
+        }
+
+        for (r = t->readers; r; r = next) {
+            next = r->next;
+            free(r);
+        }
+        free(t);
+    }
+}
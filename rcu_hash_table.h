@@ -0,0 +1,91 @@
+#ifndef _BASIC_LIB_RCU_HASH_TABLE_H_
+#define _BASIC_LIB_RCU_HASH_TABLE_H_
+
+#include <stdbool.h>
+#include "hash_table.h"
+
+/*
+ * 单写多读的并发哈希表:
+ * 读者不加锁, 只在进入/退出读临界区时各写一次自己的epoch;
+ * 唯一的写者用release语义发布节点, 删除的节点和扩容后的旧桶数组
+ * 要等所有读者都离开更早的epoch之后才释放(epoch-based reclamation).
+ * 扩容时旧表由之后的每次add/del最多迁移RCU_HASH_TABLE_REHASH_STEP个桶, 写者的延迟有上界;
+ * 读者没找到时如果和某一批迁移重叠就要重试, 所以查找是lock-free而不是wait-free:
+ * 不在扩容时不会重试, 扩容期间每次重试都对应写者完成的一批迁移, 总重试次数不超过旧表桶数/STEP.
+ * 表中的节点必须是struct hash_table_node
+ */
+#define RCU_HASH_TABLE_REHASH_STEP      4U
+
+struct rcu_hash_table_reader {
+    unsigned long epoch;                    /* 0表示不在读临界区 */
+    int in_use;
+    struct rcu_hash_table_reader *next;
+} __attribute__((aligned(64)));
+
+struct rcu_hash_table_buckets {
+    unsigned int mask;
+    struct hlist_head heads[0];
+};
+
+struct rcu_hash_table_retired {
+    unsigned long epoch;
+    struct hlist_node *node;                /* 为NULL时释放buckets */
+    struct rcu_hash_table_buckets *buckets;
+};
+
+typedef struct {
+    struct rcu_hash_table_buckets *table[2];    /* [0]当前表, [1]扩容时正在迁移的旧表 */
+    unsigned int seq;                       /* 迁移一批桶前后各加一, 读者据此重试 */
+    unsigned int rehash_index;              /* table[1]中下一个待迁移的桶 */
+    unsigned int count;
+    unsigned long epoch;
+    struct rcu_hash_table_reader *readers;
+    hash_table_index_func_t hash;
+    hash_table_release_func_t release;
+    unsigned int nr_retired;
+    unsigned int max_retired;
+    unsigned int reclaim_at;                /* 待释放的个数达到该值时才尝试回收 */
+    struct rcu_hash_table_retired *retired;
+} rcu_hash_table_t;
+
+extern rcu_hash_table_t *rcu_hash_table_create(const unsigned int size,
+                            const hash_table_index_func_t hash,
+                            const hash_table_release_func_t release);
+
+/* 每个读线程注册一次, 返回的记录在读临界区中使用 */
+extern struct rcu_hash_table_reader *rcu_hash_table_reader_register(rcu_hash_table_t *__restrict t);
+
+extern void rcu_hash_table_reader_unregister(struct rcu_hash_table_reader *__restrict r);
+
+static inline void rcu_hash_table_read_lock(rcu_hash_table_t *__restrict t,
+                    struct rcu_hash_table_reader *__restrict r)
+{
+    __atomic_store_n(&r->epoch, __atomic_load_n(&t->epoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void rcu_hash_table_read_unlock(struct rcu_hash_table_reader *__restrict r)
+{
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* 读者在读临界区内调用, 返回的节点在rcu_hash_table_read_unlock之前有效 */
+extern struct hlist_node *rcu_hash_table_find_key(rcu_hash_table_t *__restrict t,
+                            const unsigned int hash, const void *__restrict key,
+                            const hash_table_equal_func_t equal);
+
+/* 以下接口只能由写者调用 */
+extern bool rcu_hash_table_add(rcu_hash_table_t *__restrict t,
+                struct hlist_node *__restrict node);
+
+/* 摘除节点, 宽限期过后调用release */
+extern void rcu_hash_table_del(rcu_hash_table_t *__restrict t,
+                struct hlist_node *__restrict node);
+
+/* 推进epoch并释放已经没有读者引用的节点 */
+extern void rcu_hash_table_reclaim(rcu_hash_table_t *__restrict t);
+
+/* ! stop all readers and then can invoke this function */
+extern void rcu_hash_table_destory(rcu_hash_table_t *__restrict t);
+
+#endif /* _BASIC_LIB_RCU_HASH_TABLE_H_ */
@@ -0,0 +1,289 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <memcache.h>
+
+/*
+ * memcache与glibc malloc的对比测试, 每个用例在单独的子进程中运行, 以便统计峰值RSS
+ * usage: memcache-bench [threads] [ops per thread] [memcache flags]
+ */
+
+#define BENCH_SLOTS         1024U
+#define BENCH_BATCH         64U
+#define BENCH_RING_SIZE     1024U
+
+typedef struct {
+    const char *name;
+    void *(*alloc)(size_t size);
+    void (*free)(void *ptr);
+} bench_allocator_t;
+
+typedef struct {
+    const char *name;
+    void *(*run)(void *arg);
+    bool pairs;                     /* 线程两两配对, 一个申请一个释放 */
+} bench_workload_t;
+
+/* 单生产者单消费者的环, 用于跨线程释放 */
+typedef struct {
+    void *slots[BENCH_RING_SIZE];
+    unsigned int head __attribute__((aligned(64)));
+    unsigned int tail __attribute__((aligned(64)));
+} bench_ring_t;
+
+typedef struct {
+    unsigned int id;
+    unsigned long ops;
+    bench_ring_t *ring;
+} bench_thread_t;
+
+static memcache_t g_cache;
+static unsigned int g_flags;
+static const bench_allocator_t *g_allocator;
+
+static void *bench_memcache_alloc(size_t size)
+{
+    return memcache_alloc(g_cache, size);
+}
+
+static const bench_allocator_t bench_allocators[] = {
+    { "malloc", malloc, free },
+    { "memcache", bench_memcache_alloc, memcache_free },
+};
+
+static inline uint32_t bench_random(uint32_t *seed)
+{
+    uint32_t x;
+
+    x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+
+    return x;
+}
+
+/* 70%在16~128字节, 25%在129~1024字节, 5%在1025~8192字节 */
+static size_t bench_mixed_size(uint32_t *seed)
+{
+    uint32_t r;
+
+    r = bench_random(seed);
+    if (r % 100 < 70)
+        return 16 + (r >> 8) % 113;
+    if (r % 100 < 95)
+        return 129 + (r >> 8) % 896;
+
+    return 1025 + (r >> 8) % 7168;
+}
+
+static inline void bench_touch(void *ptr)
+{
+    *(volatile char *) ptr = 1;
+}
+
+/* 固定64字节, 每次申请一批再全部释放 */
+static void *bench_fixed(void *arg)
+{
+    unsigned int i;
+    unsigned long n;
+    void *objs[BENCH_BATCH];
+    bench_thread_t *bt;
+
+    bt = (bench_thread_t *) arg;
+    for (n = 0; n < bt->ops; n += BENCH_BATCH) {
+        for (i = 0; i < BENCH_BATCH; i++) {
+            objs[i] = g_allocator->alloc(64);
+            bench_touch(objs[i]);
+        }
+        for (i = 0; i < BENCH_BATCH; i++)
+            g_allocator->free(objs[i]);
+    }
+
+    return NULL;
+}
+
+/* 大小随机, 每次随机替换一个槽位中的对象 */
+static void *bench_mixed(void *arg)
+{
+    uint32_t seed;
+    unsigned int i;
+    unsigned long n;
+    void **slots;
+    bench_thread_t *bt;
+
+    bt = (bench_thread_t *) arg;
+    seed = 2463534242U + bt->id;
+    slots = (void **) calloc(BENCH_SLOTS, sizeof(void *));
+    if (!slots)
+        return NULL;
+
+    for (n = 0; n < bt->ops; n++) {
+        i = bench_random(&seed) % BENCH_SLOTS;
+        if (slots[i])
+            g_allocator->free(slots[i]);
+        slots[i] = g_allocator->alloc(bench_mixed_size(&seed));
+        bench_touch(slots[i]);
+    }
+
+    for (i = 0; i < BENCH_SLOTS; i++)
+        g_allocator->free(slots[i]);
+    free(slots);
+
+    return NULL;
+}
+
+/* 偶数线程申请后交给配对的奇数线程释放 */
+static void *bench_cross(void *arg)
+{
+    void *ptr;
+    uint32_t seed;
+    unsigned int head;
+    unsigned int tail;
+    unsigned long n;
+    bench_ring_t *ring;
+    bench_thread_t *bt;
+
+    bt = (bench_thread_t *) arg;
+    ring = bt->ring;
+    seed = 88675123U + bt->id;
+    for (n = 0; n < bt->ops; n++) {
+        if (bt->id & 1) {
+            head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+            while ((tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) == head)
+                sched_yield();
+            ptr = ring->slots[head & (BENCH_RING_SIZE - 1)];
+            __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+            g_allocator->free(ptr);
+        } else {
+            ptr = g_allocator->alloc(bench_mixed_size(&seed));
+            bench_touch(ptr);
+            tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+            while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == BENCH_RING_SIZE)
+                sched_yield();
+            ring->slots[tail & (BENCH_RING_SIZE - 1)] = ptr;
+            __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    return NULL;
+}
+
+static const bench_workload_t bench_workloads[] = {
+    { "fixed-64", bench_fixed, false },
+    { "mixed", bench_mixed, false },
+    { "cross-thread", bench_cross, true },
+};
+
+static double bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* 子进程中运行一个用例, 结果直接打印, ns/op是每个线程完成一次操作的平均耗时 */
+static int bench_run(const bench_workload_t *wl, unsigned int threads, const unsigned long ops)
+{
+    double ns;
+    unsigned int i;
+    pthread_t *tids;
+    bench_ring_t *rings;
+    bench_thread_t *bts;
+    struct rusage usage;
+
+    if (wl->pairs)
+        threads = threads < 2 ? 2 : threads & ~1U;
+
+    if (g_allocator->free == memcache_free) {
+        g_cache = memcache_create_ex(g_flags);
+        if (!g_cache)
+            return -1;
+    }
+
+    tids = (pthread_t *) calloc(threads, sizeof(pthread_t));
+    bts = (bench_thread_t *) calloc(threads, sizeof(bench_thread_t));
+    rings = (bench_ring_t *) calloc(threads / 2 + 1, sizeof(bench_ring_t));
+    if (!tids || !bts || !rings)
+        return -1;
+
+    ns = bench_now_ns();
+    for (i = 0; i < threads; i++) {
+        bts[i].id = i;
+        bts[i].ops = ops;
+        bts[i].ring = rings + i / 2;
+        if (pthread_create(tids + i, NULL, wl->run, bts + i) != 0)
+            return -1;
+    }
+
+    for (i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+    ns = bench_now_ns() - ns;
+
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%-14s %7u %-10s %10.2f %12ld\n", wl->name, threads, g_allocator->name,
+        ns / ops, usage.ru_maxrss);
+    fflush(stdout);
+
+    if (g_cache)
+        memcache_destroy(g_cache);
+    free(rings);
+    free(bts);
+    free(tids);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    pid_t pid;
+    int status;
+    unsigned int i;
+    unsigned int j;
+    unsigned int k;
+    unsigned long ops;
+    unsigned int threads[2];
+
+    threads[0] = 1;
+    threads[1] = argc > 1 ? (unsigned int) atoi(argv[1]) : 4;
+    ops = argc > 2 ? strtoul(argv[2], NULL, 0) : 2000000;
+    g_flags = argc > 3 ? (unsigned int) strtoul(argv[3], NULL, 0) : MEMCACHE_F_SIZE_CLASS;
+    if (!threads[1] || !ops) {
+        fprintf(stderr, "usage: %s [threads] [ops per thread] [memcache flags]\n", argv[0]);
+        return -1;
+    }
+
+    printf("memcache flags 0x%x, %lu ops per thread\n", g_flags, ops);
+    printf("%-14s %7s %-10s %10s %12s\n", "workload", "threads", "allocator", "ns/op", "maxrss(KB)");
+    for (i = 0; i < sizeof(bench_workloads) / sizeof(bench_workloads[0]); i++) {
+        for (j = 0; j < 2; j++) {
+            for (k = 0; k < sizeof(bench_allocators) / sizeof(bench_allocators[0]); k++) {
+                fflush(stdout);
+                pid = fork();
+                if (pid < 0)
+                    return -1;
+
+                if (pid == 0) {
+                    g_allocator = bench_allocators + k;
+                    exit(bench_run(bench_workloads + i, threads[j], ops) ? EXIT_FAILURE : EXIT_SUCCESS);
+                }
+
+                if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+                    fprintf(stderr, "%s with %s failed\n", bench_workloads[i].name, bench_allocators[k].name);
+            }
+        }
+    }
+
+    return 0;
+}
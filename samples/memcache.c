@@ -29,7 +29,7 @@ int main(void)
         }
     }
 
-    memcache_clear(cache);
+    memcache_clear(cache, false);
     for (i = 0; i < 99999; ++i) {
         pdm = memcache_alloc(cache, sizeof(struct demo_s));
         if (pdm == NULL) {
@@ -37,7 +37,7 @@ int main(void)
             break;
         }
 
-        memcache_free(cache, pdm);
+        memcache_free(pdm);
     }
 
     for (i = 0; i < 99999; ++i) {
@@ -47,9 +47,9 @@ int main(void)
             break;
         }
 
-        memcache_free(cache, pdm);
+        memcache_free(pdm);
     }
-    memcache_clear(cache);
+    memcache_clear(cache, false);
     memcache_destroy(cache);
 
     return 0;
@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sharded_hash_table.h"
+
+/* 分片数上限 */
+#define SHARDED_HASH_TABLE_MAX_SHARDS   1024U
+
+static inline void sharded_hash_table_shard_lock(struct sharded_hash_table_shard *__restrict shard)
+{
+    if (pthread_mutex_trylock(&shard->lock) != 0) {
+        pthread_mutex_lock(&shard->lock);
+        shard->stats.contended++;
+    }
+}
+
+static inline unsigned int sharded_hash_table_node_hash(const sharded_hash_table_t *__restrict t,
+                    const struct hlist_node *__restrict node)
+{
+    if (t->shards->table->flags & DUAL_HASH_TABLE_F_CACHED_HASH)
+        return hash_table_node_entry(node)->hash;
+
+    return t->hash(node);
+}
+
+sharded_hash_table_t *sharded_hash_table_create(const unsigned int nr_shards,
+                            const unsigned int size,
+                            const hash_table_index_func_t hash,
+                            const hash_table_release_func_t release,
+                            const unsigned int flags)
+{
+    unsigned int i;
+    unsigned int n;
+    unsigned int shift;
+    unsigned int shard_size;
+    sharded_hash_table_t *t;
+    struct sharded_hash_table_shard *shard;
+
+    if (!nr_shards || nr_shards > SHARDED_HASH_TABLE_MAX_SHARDS || !size || !hash || !release)
+        return NULL;
+
+    for (n = 1, shift = 32; n < nr_shards; n <<= 1)
+        shift--;
+
+    t = (sharded_hash_table_t *) malloc(sizeof(*t));
+    if (!t)
+        return NULL;
+
+    if (posix_memalign((void **) &t->shards, sizeof(*shard), n * sizeof(*shard)) != 0) {
+        free(t);
+        return NULL;
+    }
+
+    shard_size = size / n ? size / n : 1;
+    for (i = 0; i < n; i++) {
+        shard = t->shards + i;
+        memset(&shard->stats, 0, sizeof(shard->stats));
+        shard->table = dual_hash_table_create_ex(shard_size, hash, release, flags);
+        if (!shard->table)
+            break;
+        pthread_mutex_init(&shard->lock, NULL);
+    }
+
+    if (i < n) {
+        while (i--) {
+            pthread_mutex_destroy(&t->shards[i].lock);
+            dual_hash_table_destory(t->shards[i].table);
+        }
+        free(t->shards);
+        free(t);
+        return NULL;
+    }
+
+    t->shift = shift;
+    t->nr_shards = n;
+    t->hash = hash;
+
+    return t;
+}
+
+bool sharded_hash_table_add(sharded_hash_table_t *__restrict t, struct hlist_node *__restrict node)
+{
+    bool ret;
+    unsigned int hash;
+    struct sharded_hash_table_shard *shard;
+
+    if (!t || !node)
+        return false;
+
+    hash = t->hash(node);
+    shard = sharded_hash_table_shard(t, hash);
+    sharded_hash_table_shard_lock(shard);
+    ret = dual_hash_table_add_using_hash(shard->table, node, hash);
+    if (ret)
+        shard->stats.adds++;
+    pthread_mutex_unlock(&shard->lock);
+
+    return ret;
+}
+
+void sharded_hash_table_del(sharded_hash_table_t *__restrict t, struct hlist_node *__restrict node)
+{
+    struct sharded_hash_table_shard *shard;
+
+    if (!t || !node)
+        return;
+
+    shard = sharded_hash_table_shard(t, sharded_hash_table_node_hash(t, node));
+    sharded_hash_table_shard_lock(shard);
+    if (dual_hash_table_del(shard->table, node))
+        shard->stats.dels++;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+struct hlist_node *sharded_hash_table_find_key(sharded_hash_table_t *__restrict t,
+                    const unsigned int hash, const void *__restrict key,
+                    const hash_table_equal_func_t equal)
+{
+    struct hlist_node *node;
+    struct sharded_hash_table_shard *shard;
+
+    if (!t)
+        return NULL;
+
+    shard = sharded_hash_table_shard(t, hash);
+    sharded_hash_table_shard_lock(shard);
+    node = dual_hash_table_find_key(shard->table, hash, key, equal);
+    shard->stats.lookups++;
+    if (node)
+        shard->stats.hits++;
+    pthread_mutex_unlock(&shard->lock);
+
+    return node;
+}
+
+dual_hash_table_t *sharded_hash_table_lock(sharded_hash_table_t *__restrict t, const unsigned int hash)
+{
+    struct sharded_hash_table_shard *shard;
+
+    if (!t)
+        return NULL;
+
+    shard = sharded_hash_table_shard(t, hash);
+    sharded_hash_table_shard_lock(shard);
+
+    return shard->table;
+}
+
+void sharded_hash_table_unlock(sharded_hash_table_t *__restrict t, const unsigned int hash)
+{
+    struct sharded_hash_table_shard *shard;
+
+    if (t) {
+        shard = sharded_hash_table_shard(t, hash);
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+bool sharded_hash_table_stats(sharded_hash_table_t *__restrict t, const unsigned int index,
+                struct sharded_hash_table_stats *__restrict stats)
+{
+    struct sharded_hash_table_shard *shard;
+
+    if (!t || !stats || index >= t->nr_shards)
+        return false;
+
+    shard = t->shards + index;
+    pthread_mutex_lock(&shard->lock);
+    *stats = shard->stats;
+    stats->count = shard->table->count[0] + shard->table->count[1];
+    pthread_mutex_unlock(&shard->lock);
+
+    return true;
+}
+
+void sharded_hash_table_destory(sharded_hash_table_t *__restrict t)
+{
+    unsigned int i;
+
+    if (t) {
+        for (i = 0; i < t->nr_shards; i++) {
+            pthread_mutex_destroy(&t->shards[i].lock);
+            dual_hash_table_destory(t->shards[i].table);
+        }
+        free(t->shards);
+        free(t);
+    }
+}
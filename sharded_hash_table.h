@@ -0,0 +1,79 @@
+#ifndef _BASIC_LIB_SHARDED_HASH_TABLE_H_
+#define _BASIC_LIB_SHARDED_HASH_TABLE_H_
+
+#include <stdbool.h>
+#include <pthread.h>
+#include "hash_table.h"
+
+/*
+ * 多写者的分片哈希表: 按hash的高位把节点分到2^n个各自加锁的dual_hash_table_t中,
+ * 低位仍然留给分片内部选桶. 不同分片上的写操作互不阻塞
+ */
+
+struct sharded_hash_table_stats {
+    unsigned long adds;
+    unsigned long dels;         /* 真正摘除了节点的次数 */
+    unsigned long lookups;
+    unsigned long hits;
+    unsigned long contended;    /* 加锁时发现分片已被其他线程持有的次数 */
+    unsigned int count;         /* 分片中的元素个数 */
+};
+
+struct sharded_hash_table_shard {
+    pthread_mutex_t lock;
+    dual_hash_table_t *table;
+    struct sharded_hash_table_stats stats;
+} __attribute__((aligned(64)));
+
+typedef struct {
+    unsigned int shift;         /* hash右移shift位得到分片下标 */
+    unsigned int nr_shards;
+    hash_table_index_func_t hash;
+    struct sharded_hash_table_shard *shards;
+} sharded_hash_table_t;
+
+/**
+ * @brief sharded_hash_table_create 创建分片哈希表
+ * @param nr_shards 分片个数, 向上取整到2的幂
+ * @param size 总的初始桶数, 平均分给每个分片
+ * @param flags 传给每个分片的dual_hash_table_create_ex
+ */
+extern sharded_hash_table_t *sharded_hash_table_create(const unsigned int nr_shards,
+                            const unsigned int size,
+                            const hash_table_index_func_t hash,
+                            const hash_table_release_func_t release,
+                            const unsigned int flags);
+
+extern bool sharded_hash_table_add(sharded_hash_table_t *__restrict t,
+                struct hlist_node *__restrict node);
+
+/* 从表中摘除节点, 不调用release */
+extern void sharded_hash_table_del(sharded_hash_table_t *__restrict t,
+                struct hlist_node *__restrict node);
+
+/* 返回的节点不受分片锁保护, 生命周期由调用者保证 */
+extern struct hlist_node *sharded_hash_table_find_key(sharded_hash_table_t *__restrict t,
+                            const unsigned int hash, const void *__restrict key,
+                            const hash_table_equal_func_t equal);
+
+static inline struct sharded_hash_table_shard *sharded_hash_table_shard(const sharded_hash_table_t *__restrict t,
+                    const unsigned int hash)
+{
+    return t->shards + (unsigned int) ((unsigned long long) hash >> t->shift);
+}
+
+/* 锁住hash所在的分片并返回分片内的表, 用于查找后紧接着修改等复合操作 */
+extern dual_hash_table_t *sharded_hash_table_lock(sharded_hash_table_t *__restrict t,
+                            const unsigned int hash);
+
+extern void sharded_hash_table_unlock(sharded_hash_table_t *__restrict t,
+                const unsigned int hash);
+
+/* 复制第index个分片的统计信息 */
+extern bool sharded_hash_table_stats(sharded_hash_table_t *__restrict t, const unsigned int index,
+                struct sharded_hash_table_stats *__restrict stats);
+
+/* ! stop other threads and then can invoke this function */
+extern void sharded_hash_table_destory(sharded_hash_table_t *__restrict t);
+
+#endif /* _BASIC_LIB_SHARDED_HASH_TABLE_H_ */